@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Checks that the vectorized deinterleave kernels match the scalar ones bit
+// for bit, including the tails that don't fill a whole vector and the cases
+// where some outputs are skipped. Needs no GPU, so it runs anywhere.
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "deinterleave.h"
+
+// Extra bytes past each output, which must come back untouched
+static constexpr size_t GUARD = 64;
+static constexpr uint8_t GUARD_BYTE = 0xA5;
+
+// Around every vector width, plus some odd large counts
+static const size_t SIZES[] = {
+    0,  1,  2,  3,  7,   15,  16,   17,   31,    32,  33,
+    47, 63, 64, 65, 255, 257, 1001, 4099, 65537, 640 * 480 + 3,
+};
+
+// An output buffer, or none at all when `present` is false
+static std::vector<uint8_t> output(size_t bytes, bool present) {
+    return present ? std::vector<uint8_t>(bytes + GUARD, GUARD_BYTE)
+                   : std::vector<uint8_t>{};
+}
+
+static uint8_t *pointer(std::vector<uint8_t> &buffer) {
+    return buffer.empty() ? nullptr : buffer.data();
+}
+
+static bool checkColorAlpha(const std::vector<uint8_t> &in, size_t pixels,
+                            bool withColor, bool withAlpha) {
+    auto color = output(pixels * 3, withColor);
+    auto alpha = output(pixels, withAlpha);
+    auto colorRef = output(pixels * 3, withColor);
+    auto alphaRef = output(pixels, withAlpha);
+
+    deinterleaveColorAlpha(in.data(), pointer(color), pointer(alpha), pixels);
+    deinterleaveColorAlphaScalar(in.data(), pointer(colorRef),
+                                 pointer(alphaRef), pixels);
+
+    if (color == colorRef && alpha == alphaRef) {
+        return true;
+    }
+    std::printf("deinterleaveColorAlpha mismatch: %zu pixels, color %d, "
+                "alpha %d\n",
+                pixels, withColor, withAlpha);
+    return false;
+}
+
+static bool checkPlanes(const std::vector<uint8_t> &in, size_t pixels,
+                        unsigned mask) {
+    std::array<std::vector<uint8_t>, 4> planes;
+    std::array<std::vector<uint8_t>, 4> planesRef;
+    uint8_t *pointers[4];
+    uint8_t *pointersRef[4];
+    for (int c = 0; c < 4; c++) {
+        bool present = mask & (1 << c);
+        planes[c] = output(pixels, present);
+        planesRef[c] = output(pixels, present);
+        pointers[c] = pointer(planes[c]);
+        pointersRef[c] = pointer(planesRef[c]);
+    }
+
+    deinterleavePlanes(in.data(), pointers, pixels);
+    deinterleavePlanesScalar(in.data(), pointersRef, pixels);
+
+    if (planes == planesRef) {
+        return true;
+    }
+    std::printf("deinterleavePlanes mismatch: %zu pixels, planes %x\n", pixels,
+                mask);
+    return false;
+}
+
+int main() {
+    std::mt19937 rng(2024);
+    std::uniform_int_distribution<int> byte(0, 255);
+
+    int failures = 0;
+    for (size_t pixels : SIZES) {
+        std::vector<uint8_t> in(pixels * 4);
+        for (auto &b : in) {
+            b = byte(rng);
+        }
+
+        for (bool withColor : {false, true}) {
+            for (bool withAlpha : {false, true}) {
+                failures += !checkColorAlpha(in, pixels, withColor, withAlpha);
+            }
+        }
+        for (unsigned mask = 0; mask < 16; mask++) {
+            failures += !checkPlanes(in, pixels, mask);
+        }
+    }
+
+    if (failures) {
+        std::printf("%d mismatches\n", failures);
+        return 1;
+    }
+    std::printf("deinterleave matches scalar for all %zu sizes\n",
+                sizeof(SIZES) / sizeof(SIZES[0]));
+    return 0;
+}
@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Runs GlHsvThresholder and the display thread's copy over synthetic YUV420
+// frames, without a camera. Works on llvmpipe through surfaceless EGL, so it
+// can catch performance regressions on a machine with no GPU.
+//
+// Usage: photon_bench [frames] [WIDTHxHEIGHT ...]
+
+#include <linux/dma-buf.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "deinterleave.h"
+#include "dma_buf_alloc.h"
+#include "gl_hsv_thresholder.h"
+#include "pipeline_stats.h"
+
+using steady_clock = std::chrono::steady_clock;
+
+static constexpr int INPUT_BUFFER_COUNT = 4;
+static constexpr int OUTPUT_BUFFER_COUNT = 3;
+
+static const char *PROCESS_TYPE_NAMES[] = {"None",     "Hsv",   "Gray",
+                                            "Adaptive", "Multi", "HsvRanges"};
+
+struct Resolution {
+    int width;
+    int height;
+};
+
+// Fills an I420 buffer with a pattern that varies per frame, so every shader
+// has a mix of pixels inside and outside its thresholds
+static void fillYuv(int fd, int width, int height, int seed) {
+    size_t size = width * height * 3 / 2;
+    auto ptr = static_cast<uint8_t *>(
+        mmap(nullptr, size, PROT_WRITE, MAP_SHARED, fd, 0));
+    if (ptr == MAP_FAILED) {
+        throw std::runtime_error("failed to mmap input");
+    }
+
+    syncDmaBuf(fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+    uint8_t *y = ptr;
+    uint8_t *u = y + width * height;
+    uint8_t *v = u + width * height / 4;
+    for (int row = 0; row < height; row++) {
+        for (int col = 0; col < width; col++) {
+            y[row * width + col] = (row + col + seed * 8) & 0xFF;
+        }
+    }
+    for (int row = 0; row < height / 2; row++) {
+        for (int col = 0; col < width / 2; col++) {
+            u[row * width / 2 + col] = (col * 2 + seed * 16) & 0xFF;
+            v[row * width / 2 + col] = (row * 2 + seed * 32) & 0xFF;
+        }
+    }
+    syncDmaBuf(fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+
+    munmap(ptr, size);
+}
+
+static void bench(const std::function<int(size_t)> &alloc, Resolution res,
+                  int frames) {
+    const int width = res.width;
+    const int height = res.height;
+    const size_t pixels = width * height;
+
+    std::vector<int> input_fds;
+    std::vector<std::array<GlHsvThresholder::DmaBufPlaneData, 3>> inputs;
+    for (int i = 0; i < INPUT_BUFFER_COUNT; i++) {
+        int fd = alloc(pixels * 3 / 2);
+        fillYuv(fd, width, height, i);
+        input_fds.push_back(fd);
+        inputs.push_back({{
+            {fd, 0, width},
+            {fd, static_cast<EGLint>(pixels), width / 2},
+            {fd, static_cast<EGLint>(pixels * 5 / 4), width / 2},
+        }});
+    }
+
+    std::vector<int> output_fds;
+    std::unordered_map<int, uint8_t *> mmaped;
+    for (int i = 0; i < OUTPUT_BUFFER_COUNT; i++) {
+        int fd = alloc(pixels * 4);
+        auto ptr = mmap(nullptr, pixels * 4, PROT_READ, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) {
+            throw std::runtime_error("failed to mmap output");
+        }
+        output_fds.push_back(fd);
+        mmaped.emplace(fd, static_cast<uint8_t *>(ptr));
+    }
+
+    std::vector<uint8_t> color(pixels * 3);
+    std::vector<uint8_t> processed(pixels);
+    std::vector<uint8_t> color_ref(pixels * 3);
+    std::vector<uint8_t> processed_ref(pixels);
+    // Multi's four results, one after another
+    std::vector<uint8_t> planes(pixels * 4);
+    std::vector<uint8_t> planes_ref(pixels * 4);
+    auto planePointers = [&](std::vector<uint8_t> &buffer) {
+        return std::array<uint8_t *, 4>{
+            buffer.data(), buffer.data() + pixels, buffer.data() + pixels * 2,
+            buffer.data() + pixels * 3};
+    };
+
+    // Synthetic frames are BT.601 limited range, like the Pi cameras
+    const EGLint encoding = EGL_ITU_REC601_EXT;
+    const EGLint range = EGL_YUV_NARROW_RANGE_EXT;
+
+    GlHsvThresholder thresholder(width, height, CameraModel::Unknown);
+    thresholder.start(output_fds, inputs, encoding, range);
+    thresholder.setHsvThresholds(0.1, 0.2, 0.2, 0.6, 1.0, 1.0, false);
+    thresholder.setHsvRange(1, 0.05, 0.2, 0.2, 0.9, 1.0, 1.0, true);
+    // As many as HsvRanges takes, since it checks every one
+    std::vector<HsvRange> ranges;
+    for (int i = 0; i < GlHsvThresholder::MAX_HSV_RANGES; i++) {
+        float hue = i / static_cast<float>(GlHsvThresholder::MAX_HSV_RANGES);
+        ranges.push_back({{hue, 0.2f, 0.2f},
+                          {hue + 0.2f, 1.0f, 1.0f},
+                          false,
+                          static_cast<uint8_t>(i + 1)});
+    }
+    thresholder.setHsvRanges(ranges, HsvEncoding::Bitmask);
+
+    for (int t = 0; t < static_cast<int>(ProcessType::NUM_PROCESS_TYPES);
+         t++) {
+        auto type = static_cast<ProcessType>(t);
+        LatencyHistogram render;
+        LatencyHistogram copy;
+        LatencyHistogram total;
+        bool matches = true;
+
+        struct InFlight {
+            GlHsvThresholder::RenderedFrame frame;
+            int64_t submittedNs;
+        };
+        std::deque<InFlight> in_flight;
+
+        // Same as the display thread: wait for the GPU, then split the
+        // output into color and processed planes
+        auto finish = [&](const InFlight &f, bool check) {
+            thresholder.waitForRender(f.frame);
+            int64_t renderedNs = bootTimeNs();
+
+            syncDmaBuf(f.frame.fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+            const uint8_t *out = mmaped.at(f.frame.fd);
+            if (type == ProcessType::Multi) {
+                deinterleavePlanes(out, planePointers(planes).data(),
+                                   pixels);
+                if (check) {
+                    deinterleavePlanesScalar(
+                        out, planePointers(planes_ref).data(), pixels);
+                    matches = planes == planes_ref;
+                }
+            } else {
+                deinterleaveColorAlpha(out, color.data(), processed.data(),
+                                       pixels);
+                if (check) {
+                    deinterleaveColorAlphaScalar(out, color_ref.data(),
+                                                 processed_ref.data(), pixels);
+                    matches = color == color_ref && processed == processed_ref;
+                }
+            }
+            syncDmaBuf(f.frame.fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+            thresholder.returnBuffer(f.frame.fd);
+
+            int64_t copiedNs = bootTimeNs();
+            render.record((renderedNs - f.submittedNs) / 1000);
+            copy.record((copiedNs - renderedNs) / 1000);
+            total.record((copiedNs - f.submittedNs) / 1000);
+        };
+
+        auto begin = steady_clock::now();
+        for (int i = 0; i < frames; i++) {
+            int64_t submittedNs = bootTimeNs();
+            auto frame = thresholder.testFrame(inputs[i % inputs.size()],
+                                               encoding, range, type);
+            // Out of output buffers; finish the oldest frame to free one up
+            while (frame.fd == 0) {
+                finish(in_flight.front(), false);
+                in_flight.pop_front();
+                submittedNs = bootTimeNs();
+                frame = thresholder.testFrame(inputs[i % inputs.size()],
+                                              encoding, range, type);
+            }
+            in_flight.push_back({frame, submittedNs});
+        }
+        while (!in_flight.empty()) {
+            finish(in_flight.front(), in_flight.size() == 1);
+            in_flight.pop_front();
+        }
+        std::chrono::duration<double> elapsed = steady_clock::now() - begin;
+
+        auto r = render.snapshot();
+        auto c = copy.snapshot();
+        auto s = total.snapshot();
+        std::printf("%4dx%-4d %-8s %7.1f fps  render p50 %6" PRIu64
+                    " p99 %6" PRIu64 " us  copy p50 %6" PRIu64
+                    " p99 %6" PRIu64 " us  total p50 %6" PRIu64
+                    " p99 %6" PRIu64 " max %6" PRIu64 " us%s\n",
+                    width, height, PROCESS_TYPE_NAMES[t],
+                    frames / elapsed.count(), r.p50, r.p99, c.p50, c.p99,
+                    s.p50, s.p99, s.max,
+                    matches ? "" : "  DEINTERLEAVE MISMATCH");
+    }
+
+    thresholder.release();
+
+    for (const auto &[fd, ptr] : mmaped) {
+        munmap(ptr, pixels * 4);
+    }
+    for (int fd : output_fds) {
+        close(fd);
+    }
+    for (int fd : input_fds) {
+        close(fd);
+    }
+}
+
+int main(int argc, char **argv) {
+    int frames = argc > 1 ? std::atoi(argv[1]) : 300;
+
+    std::vector<Resolution> resolutions;
+    for (int i = 2; i < argc; i++) {
+        Resolution res;
+        if (std::sscanf(argv[i], "%dx%d", &res.width, &res.height) != 2) {
+            std::fprintf(stderr, "Bad resolution %s\n", argv[i]);
+            return 1;
+        }
+        resolutions.push_back(res);
+    }
+    if (resolutions.empty()) {
+        resolutions = {{640, 480}, {1280, 800}, {1920, 1080}};
+    }
+
+    auto alloc = makeAnyDmaBufAllocator();
+    for (auto res : resolutions) {
+        bench(alloc, res, frames);
+    }
+
+    return 0;
+}
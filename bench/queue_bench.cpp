@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Compares SpscQueue against ConcurrentBlockingQueue for the two things the
+// camera pipeline cares about: how long a blocked consumer takes to wake up
+// with a new item, and how many items per second one thread can hand another.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "concurrent_blocking_queue.h"
+#include "spsc_queue.h"
+
+using steady_clock = std::chrono::steady_clock;
+
+// Gives both queue types the same interface. SpscQueue::push fails when full,
+// which the pipeline never hits, so just spin here.
+template <typename Queue> static void push(Queue &queue, int64_t value) {
+    if constexpr (std::is_same_v<Queue, SpscQueue<int64_t>>) {
+        while (!queue.push(value)) {
+            std::this_thread::yield();
+        }
+    } else {
+        queue.push(value);
+    }
+}
+
+// Bounces an item between two threads, so every pop() has to wake a sleeping
+// consumer. Returns the one-way handoff latencies in nanoseconds.
+template <typename Queue> static std::vector<double> pingPong(int iterations) {
+    Queue ping(16);
+    Queue pong(16);
+
+    std::thread echo([&] {
+        while (true) {
+            int64_t v = ping.pop();
+            push(pong, v);
+            if (v < 0) {
+                break;
+            }
+        }
+    });
+
+    std::vector<double> latencies;
+    latencies.reserve(iterations);
+    for (int i = 0; i < iterations; i++) {
+        auto begin = steady_clock::now();
+        push(ping, i);
+        pong.pop();
+        std::chrono::duration<double, std::nano> elapsed =
+            steady_clock::now() - begin;
+        latencies.push_back(elapsed.count() / 2);
+    }
+    push(ping, -1);
+    pong.pop();
+    echo.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    return latencies;
+}
+
+// Returns items per second for one producer streaming to one consumer
+template <typename Queue> static double throughput(int64_t items) {
+    Queue queue(64);
+
+    auto begin = steady_clock::now();
+    std::thread consumer([&] {
+        for (int64_t i = 0; i < items; i++) {
+            queue.pop();
+        }
+    });
+    for (int64_t i = 0; i < items; i++) {
+        push(queue, i);
+    }
+    consumer.join();
+    std::chrono::duration<double> elapsed = steady_clock::now() - begin;
+
+    return items / elapsed.count();
+}
+
+template <typename Queue>
+static void run(const char *name, int iterations, int64_t items) {
+    auto latencies = pingPong<Queue>(iterations);
+    auto percentile = [&](double p) {
+        return latencies[static_cast<size_t>(p * (latencies.size() - 1))];
+    };
+
+    std::printf("%-24s handoff p50 %8.0f ns  p99 %8.0f ns  max %8.0f ns  "
+                "throughput %6.2f M/s\n",
+                name, percentile(0.5), percentile(0.99), latencies.back(),
+                throughput<Queue>(items) / 1e6);
+}
+
+// ConcurrentBlockingQueue has no capacity, so give it a constructor that
+// matches SpscQueue's
+struct BlockingQueue : ConcurrentBlockingQueue<int64_t> {
+    explicit BlockingQueue(size_t) {}
+};
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? std::atoi(argv[1]) : 100000;
+    int64_t items = argc > 2 ? std::atoll(argv[2]) : 10000000;
+
+    run<BlockingQueue>("ConcurrentBlockingQueue", iterations, items);
+    run<SpscQueue<int64_t>>("SpscQueue", iterations, items);
+
+    return 0;
+}
@@ -27,11 +27,14 @@ template <typename T> class BlockingFuture {
   public:
     BlockingFuture() = default;
 
-    void set(T &&item) {
+    // Returns true if this replaced an item nobody had taken yet
+    bool set(T &&item) {
         std::unique_lock<std::mutex> lock(m_mutex);
+        bool replaced = m_data.has_value();
         m_data = std::make_optional<>(std::forward<T>(item));
         lock.unlock();
         m_cond.notify_one();
+        return replaced;
     }
 
     T take() {
@@ -26,38 +26,42 @@
 #include <vector>
 
 #include "camera_model.h"
+#include "frame_source.h"
+#include "sensor_modes.h"
 
-struct CameraSettings {
-    int32_t exposureTimeUs = 10000;
-    float analogGain = 2;
-    float brightness = 0.0;
-    float contrast = 1;
-    float awbRedGain = 1.5;
-    float awbBlueGain = 1.5;
-    float saturation = 1;
-    bool doAutoExposure = false;
-    // float digitalGain = 100;
-};
-
-class CameraGrabber {
+// Frames from a libcamera camera
+class CameraGrabber : public FrameSource {
   public:
-    explicit CameraGrabber(std::shared_ptr<libcamera::Camera> camera, int width,
-                           int height, int rotation);
-    ~CameraGrabber();
+    // bufferCount is how many buffers (and requests) to cycle through, or 0
+    // to use libcamera's default. sensorMode picks the sensor readout mode,
+    // rather than letting libcamera choose one. With a processSize, width x
+    // height becomes the full resolution stream, and buffers() is a second
+    // stream scaled down to processSize by the ISP.
+    explicit CameraGrabber(
+        std::shared_ptr<libcamera::Camera> camera, int width, int height,
+        int rotation, unsigned int bufferCount = 0,
+        const std::optional<SensorMode> &sensorMode = std::nullopt,
+        const std::optional<libcamera::Size> &processSize = std::nullopt);
+    ~CameraGrabber() override;
 
-    const libcamera::StreamConfiguration &streamConfiguration();
-    void setOnData(std::function<void(libcamera::Request *)> onData);
-    void resetOnData();
+    const libcamera::StreamConfiguration &streamConfiguration() const;
 
-    inline CameraModel model() const { return m_model; }
+    int width() const override;
+    int height() const override;
+    const std::vector<YuvBuffer> &buffers() const override;
+    const std::vector<YuvBuffer> &fullResBuffers() const override;
+    int fullResWidth() const override;
+    int fullResHeight() const override;
+    libcamera::ColorSpace colorSpace() const override;
 
-    inline CameraSettings &cameraSettings() { return m_settings; }
+    inline CameraModel model() const override { return m_model; }
+    std::optional<std::pair<int64_t, int64_t>>
+    frameDurationLimits() const override;
+    std::optional<CropRect> scalerCropMaximum() const override;
 
-    // Note: these 3 functions must be protected by mutual exclusion.
-    // Failure to do so will result in UB.
-    bool startAndQueue();
-    void stop();
-    void requeueRequest(libcamera::Request *request);
+    bool startAndQueue() override;
+    void stop() override;
+    void requeue(const Frame &frame) override;
 
   private:
     void requestComplete(libcamera::Request *request);
@@ -71,10 +75,17 @@ class CameraGrabber {
     std::optional<std::array<libcamera::ControlValue, 4>>
         m_cameraExposureProfiles;
     std::unique_ptr<libcamera::CameraConfiguration> m_config;
+    // One per request, at the index given by the request's cookie
+    std::vector<YuvBuffer> m_buffers;
+    std::vector<YuvBuffer> m_fullResBuffers;
+    // Which stream in m_config is buffers(). The full resolution stream, if
+    // there's a separate one, is always 0.
+    unsigned int m_processIndex = 0;
 
-    std::optional<std::function<void(libcamera::Request *)>> m_onData;
-
-    CameraSettings m_settings{};
+    // What the last request we queued brought the camera up to, or nullopt
+    // if nothing has been queued since starting
+    std::optional<CameraSettings> m_queuedSettings;
+    uint32_t m_queuedVersion = 0;
     bool running = false;
 
     void setControls(libcamera::Request *request);
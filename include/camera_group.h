@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "blocking_future.h"
+#include "camera_runner.h"
+#include "pipeline_stats.h"
+
+// One frame from each camera in a CameraGroup, all captured within the
+// group's tolerance of each other. frames[i] came from runners[i].
+struct FrameSet {
+    std::vector<MatPair> frames;
+    // Newest sensor timestamp minus the oldest
+    int64_t skewNs;
+};
+
+struct CameraGroupStats {
+    // Microseconds between the first and last exposure in each set
+    LatencyHistogram skew;
+
+    std::atomic<uint64_t> setsPublished{0};
+    // Frames thrown away because no other camera had one close enough
+    std::atomic<uint64_t> unmatchedFrames{0};
+    // A set was replaced in `outgoing` before anyone took it
+    std::atomic<uint64_t> unconsumedSets{0};
+
+    void reset() {
+        skew.reset();
+        setsPublished = 0;
+        unmatchedFrames = 0;
+        unconsumedSets = 0;
+    }
+
+    // Flattened as [count, p50, p90, p99, max] of skew in microseconds,
+    // followed by setsPublished, unmatchedFrames and unconsumedSets
+    std::vector<int64_t> flatten() const;
+};
+
+// Runs several cameras as one, pairing up their frames by sensor timestamp.
+// The cameras aren't triggered together, so for frames to pair up reliably
+// they should run at the same fixed frame rate (see
+// CameraSettings::minFrameDurationUs).
+//
+// The group takes over the runners' `outgoing`, so frames must only be taken
+// from the group's. It doesn't own the runners, which must outlive it.
+class CameraGroup {
+  public:
+    CameraGroup(std::vector<CameraRunner *> runners, int64_t toleranceNs);
+    ~CameraGroup();
+
+    CameraGroup(const CameraGroup &) = delete;
+    CameraGroup &operator=(const CameraGroup &) = delete;
+
+    // Start and stop every runner in the group. Same rules as
+    // CameraRunner::start and stop.
+    bool start();
+    void stop();
+
+    inline size_t size() const { return m_runners.size(); }
+    inline const CameraGroupStats &stats() const { return m_stats; }
+
+    BlockingFuture<FrameSet> outgoing;
+
+  private:
+    // Takes frames from runner i until stopped
+    void collect(size_t i);
+    // Publishes every set that can be made from m_pending, and throws away
+    // frames that can't be part of one. Called with m_mutex held.
+    void match();
+
+    std::vector<CameraRunner *> m_runners;
+    int64_t m_toleranceNs;
+
+    std::mutex m_mutex;
+    // Frames waiting for a match, oldest first, one queue per runner
+    std::vector<std::deque<MatPair>> m_pending;
+
+    std::vector<std::thread> m_collectors;
+    bool m_running = false;
+
+    CameraGroupStats m_stats;
+};
@@ -19,8 +19,12 @@
 
 #include <libcamera/camera.h>
 
+#include <array>
 #include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <thread>
 #include <vector>
@@ -28,40 +32,123 @@
 #include <opencv2/core.hpp>
 
 #include "blocking_future.h"
+#include "capture_recorder.h"
 #include "camera_grabber.h"
-#include "concurrent_blocking_queue.h"
 #include "dma_buf_alloc.h"
+#include "frame_source.h"
 #include "gl_hsv_thresholder.h"
 #include "libcamera_opengl_utility.h"
+#include "mat_pool.h"
+#include "output_leases.h"
+#include "pipeline_stats.h"
+#include "spsc_queue.h"
 
+// The Mats that are filled in depend on the runner's OutputFormat
 struct MatPair {
+    // BGR, or just gray (CV_8UC1) from a mono sensor
     cv::Mat color;
+    // For ProcessType::Multi, the adaptive threshold
     cv::Mat processed;
-    int64_t captureTimestamp;    // In libcamera time units, hopefully uS? TODO
-                                 // actually implement
+    // ProcessType::Multi's other results: HSV range 0's mask, HSV range 1's
+    // mask, and gray. Empty for every other type.
+    std::array<cv::Mat, 3> processedPlanes;
+    // When the sensor started exposing the frame, in nanoseconds of
+    // CLOCK_BOOTTIME (libcamera's SensorTimestamp), or 0 if unknown.
+    // CameraGroup matches frames across cameras by this.
+    int64_t captureTimestamp;
     int32_t frameProcessingType; // enum value of shader run on the image
     // Per-frame exposure integration time in microseconds, as reported by
     // libcamera::controls::ExposureTime. 0 means the metadata was not
     // available for this frame; consumers should leave timestamps uncorrected.
     int32_t exposureTimeUs;
+    // The frame from the full resolution stream, as I420 (height * 3/2 rows
+    // of width bytes). Only filled in when the runner has a separate
+    // processing stream and full resolution copies have been asked for.
+    cv::Mat fullRes;
+    // Part of the sensor this frame was scaled from, in the coordinates of
+    // FrameSource::scalerCropMaximum(), for mapping image points back onto
+    // the sensor. Empty if unknown.
+    cv::Rect scalerCrop;
 
     MatPair() = default;
     explicit MatPair(int width, int height)
         : color(height, width, CV_8UC3), processed(height, width, CV_8UC1) {}
 };
 
+// How the camera is set up, and how deep the pipeline's buffering is. More
+// buffers absorb bursts from a slow consumer without dropping frames, at the
+// cost of latency.
+struct RunnerOptions {
+    // Camera buffers (and requests) libcamera cycles through, or 0 for
+    // libcamera's default
+    unsigned int cameraBufferCount = 0;
+    // dma-bufs the GPU renders into. testFrame drops frames while all of
+    // these are waiting to be copied out.
+    int outputBufferCount = 3;
+    // When several camera frames are waiting, skip straight to the newest
+    bool dropStaleFrames = false;
+    // Sensor readout mode to use, or nullopt to let libcamera choose
+    std::optional<SensorMode> sensorMode;
+    // Size to threshold at. The ISP scales each frame down to this in a
+    // second stream, and the full size is only copied out on request. The
+    // default processes frames at the full size.
+    std::optional<libcamera::Size> processSize;
+    // Which Mats each MatPair holds, and what's in them. Output buffers are
+    // sized to match, so formats with less in them move less memory.
+    OutputFormat outputFormat = OutputFormat::ColorAndProcessed;
+
+    // Minimal buffering, always processing the freshest frame
+    static RunnerOptions latencyFirst() {
+        return {2, 2, true, std::nullopt, std::nullopt,
+                OutputFormat::ColorAndProcessed};
+    }
+    // Deeper pipelining, so a slow consumer doesn't cause drops
+    static RunnerOptions throughputFirst() {
+        return {6, 5, false, std::nullopt, std::nullopt,
+                OutputFormat::ColorAndProcessed};
+    }
+
+    // Throws if any of the counts or the format are out of range
+    void validate() const;
+};
+
+// What to do when zero-copy frames hold so many output buffers that the GPU
+// would run out
+enum class LeaseExhaustion {
+    // Keep leasing; the GPU drops frames until something is released
+    DropFrames,
+    // Copy frames out as usual, keeping one buffer free for the GPU
+    Copy,
+};
+
 // Note: destructing this class without calling `stop` if `start` was called
 // is undefined behavior.
 class CameraRunner {
   public:
     CameraRunner(int width, int height, int rotation,
-                 std::shared_ptr<libcamera::Camera> cam);
+                 std::shared_ptr<libcamera::Camera> cam,
+                 const RunnerOptions &options = {});
+    explicit CameraRunner(std::unique_ptr<FrameSource> source,
+                          const RunnerOptions &options = {});
     ~CameraRunner();
 
-    inline CameraGrabber &cameraGrabber() { return grabber; }
+    inline FrameSource &frameSource() { return *m_source; }
     inline GlHsvThresholder &thresholder() { return m_thresholder; }
-    inline CameraModel model() const { return grabber.model(); }
+    inline CameraModel model() const { return m_source->model(); }
     void setCopyOptions(bool copyInput, bool copyOutput);
+    // Whether to copy each frame of the full resolution stream into
+    // MatPair::fullRes. Does nothing without a separate processing stream.
+    void setCopyFullRes(bool copyFullRes);
+    // Rather than copying rendered frames out, hand out Mats viewing the
+    // output buffer itself, which isn't rendered into again until they're
+    // released. Only offered where the rendered buffer already has the
+    // layout a copy would: one channel buffers, which become `processed`,
+    // and OutputFormat::Bgra, whose BGRA buffers become `color`. Returns
+    // false, leaving zero-copy off, for the other formats the GPU renders.
+    // Formats the GPU doesn't render are unaffected.
+    bool setZeroCopy(bool zeroCopy, LeaseExhaustion exhaustion);
+    // How many output buffers are held by zero-copy frames
+    int leasesOutstanding() const;
 
     // Note: all following functions must be protected by mutual exclusion.
     // Failure to do so will result in UB.
@@ -78,25 +165,70 @@ class CameraRunner {
 
     void requestShaderIdx(int idx);
 
+    inline const PipelineStats &stats() const { return m_stats; }
+
+    // Starts copying every frame from the source into a capture file, for
+    // up to maxFrames frames. Replaces any recording already in progress.
+    void startRecording(const std::string &path, uint32_t maxFrames);
+    // Returns the number of frames written, or -1 if we weren't recording
+    int64_t stopRecording();
+
   private:
+    // Fills in `pair` from a rendered output buffer, per the output format
+    void copyRendered(const uint8_t *rendered, ProcessType type,
+                      MatPair &pair);
+    // Whether the display thread should lease the next frame out
+    bool shouldLease() const;
+    // Hands a camera frame back to the source to be filled again
+    void requeue(const Frame &frame);
+
+    struct CameraQueueData {
+        Frame frame;
+        int64_t completedNs;
+    };
+
     struct GpuQueueData {
-        int fd;
+        GlHsvThresholder::RenderedFrame frame;
         ProcessType type;
         uint64_t captureTimestamp;
         int32_t exposureTimeUs;
+        int64_t gpuSubmittedNs;
+        CropRect scalerCrop;
+        // Set by the threshold thread when color is copied straight from the
+        // camera. With frame.fd 0, nothing was rendered.
+        cv::Mat color;
+        cv::Mat fullRes;
+        // The camera frame that was rendered from. The GPU may still be
+        // reading it, so it's only requeued once the render is done. -1 if
+        // it's already been requeued.
+        Frame input{-1, {}};
     };
 
     std::thread m_threshold;
-    std::shared_ptr<libcamera::Camera> m_camera;
+    RunnerOptions m_options;
+    std::unique_ptr<FrameSource> m_source;
     int m_width, m_height;
 
-    CameraGrabber grabber;
-    ConcurrentBlockingQueue<libcamera::Request *> camera_queue{};
-    ConcurrentBlockingQueue<GpuQueueData> gpu_queue{};
+    // the frame source's thread -> threshold thread
+    SpscQueue<CameraQueueData> camera_queue;
+    // threshold thread -> display thread
+    SpscQueue<GpuQueueData> gpu_queue;
     GlHsvThresholder m_thresholder;
-    DmaBufAlloc allocer;
+    // CMA on a Pi, but anything works when replaying elsewhere
+    std::function<int(size_t)> allocer;
 
     std::vector<int> fds{};
+    // The output buffers, mapped. Null if the output format doesn't render.
+    std::shared_ptr<OutputLeases> m_leases;
+
+    // Backing storage for the MatPairs handed out by the display thread.
+    // Null when the output format has no such Mat.
+    std::shared_ptr<MatPool> m_colorPool;
+    std::shared_ptr<MatPool> m_processedPool;
+    // All four of ProcessType::Multi's results, made on its first frame
+    std::shared_ptr<MatPool> m_planesPool;
+    // Null unless the source has a full resolution stream
+    std::shared_ptr<MatPool> m_fullResPool;
 
     std::mutex camera_stop_mutex;
 
@@ -107,4 +239,14 @@ class CameraRunner {
 
     std::atomic<bool> m_copyInput;
     std::atomic<bool> m_copyOutput;
+    std::atomic<bool> m_copyFullRes = false;
+    std::atomic<bool> m_zeroCopy = false;
+    std::atomic<LeaseExhaustion> m_leaseExhaustion = LeaseExhaustion::Copy;
+
+    PipelineStats m_stats;
+
+    // Held by the threshold thread while it records a frame, so stopping a
+    // recording can't race with it
+    std::mutex m_recorder_mutex;
+    std::unique_ptr<CaptureRecorder> m_recorder;
 };
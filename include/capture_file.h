@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <libcamera/color_space.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "camera_model.h"
+
+/*
+ * Capture files hold raw YUV420 frames and their metadata, so a run can be
+ * replayed through the pipeline later. Everything is in host byte order.
+ *
+ *   CaptureFileHeader                          at 0
+ *   CaptureFrameIndex[header.frameCapacity]    at header.indexOffset
+ *   frame data                                 from header.dataOffset
+ *
+ * Each frame is header.frameSize bytes, starting at its index entry's
+ * offset: the Y plane (stride * height bytes), then the U and V planes
+ * (stride / 2 * height / 2 bytes each). Frame offsets are page aligned.
+ *
+ * Files are preallocated for frameCapacity frames, of which the first
+ * frameCount have been written. Readers must ignore the index entries past
+ * frameCount.
+ */
+
+inline constexpr char CAPTURE_FILE_MAGIC[8] = {'P', 'H', 'O', 'T',
+                                               'O', 'N', 'C', 'F'};
+inline constexpr uint32_t CAPTURE_FILE_VERSION = 1;
+
+struct CaptureFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride; // of the Y plane; the U and V planes are half this
+    uint32_t frameSize;
+    uint32_t model; // CameraModel
+    // libcamera::ColorSpace, one enum value each
+    uint8_t primaries;
+    uint8_t transferFunction;
+    uint8_t ycbcrEncoding;
+    uint8_t range;
+    uint32_t frameCapacity;
+    uint32_t frameCount;
+    uint32_t reserved;
+    uint64_t indexOffset;
+    uint64_t dataOffset;
+};
+static_assert(sizeof(CaptureFileHeader) == 64);
+
+struct CaptureFrameIndex {
+    uint64_t offset;
+    uint64_t sensorTimestamp; // CLOCK_BOOTTIME nanoseconds
+    int32_t exposureTimeUs;
+    float analogGain;
+    uint32_t sequence;
+    uint32_t reserved;
+};
+static_assert(sizeof(CaptureFrameIndex) == 32);
+
+libcamera::ColorSpace captureColorSpace(const CaptureFileHeader &header);
+
+// Maps a capture file and checks that it's well formed, so frames can be
+// read from it by index
+class CaptureFileReader {
+  public:
+    explicit CaptureFileReader(const std::string &path);
+    ~CaptureFileReader();
+
+    CaptureFileReader(const CaptureFileReader &) = delete;
+    CaptureFileReader &operator=(const CaptureFileReader &) = delete;
+
+    inline const CaptureFileHeader &header() const { return *m_header; }
+    inline uint32_t frameCount() const { return m_header->frameCount; }
+
+    const CaptureFrameIndex &index(uint32_t frame) const;
+    // header().frameSize bytes of YUV420
+    const uint8_t *frame(uint32_t frame) const;
+
+  private:
+    int m_fd;
+    uint8_t *m_data;
+    size_t m_size;
+    const CaptureFileHeader *m_header;
+    const CaptureFrameIndex *m_index;
+};
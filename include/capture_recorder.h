@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "capture_file.h"
+#include "frame_source.h"
+#include "spsc_queue.h"
+
+// Writes frames to a capture file (see capture_file.h) without doing any I/O
+// on the calling thread. record() copies each frame into a preallocated ring
+// slot, and a background thread moves the slots into the memory-mapped file.
+class CaptureRecorder {
+  public:
+    /**
+     * @param path File to create, replacing any existing one
+     * @param maxFrames How many frames to preallocate the file for. Frames
+     * past this are dropped.
+     * @param ringSize How many frames can be waiting to be written before
+     * record() starts dropping them
+     */
+    CaptureRecorder(const std::string &path, int width, int height,
+                    unsigned int stride, CameraModel model,
+                    const libcamera::ColorSpace &colorSpace, uint32_t maxFrames,
+                    int ringSize = 8);
+    ~CaptureRecorder();
+
+    CaptureRecorder(const CaptureRecorder &) = delete;
+    CaptureRecorder &operator=(const CaptureRecorder &) = delete;
+
+    // Only ever call from one thread. Returns false if the frame was dropped.
+    bool record(const YuvBuffer &buffer, const FrameMetadata &metadata);
+
+    // Writes out any frames still in the ring, and trims the file to the
+    // frames actually recorded. Must not race with record(), and nothing
+    // can be recorded afterwards. Returns the number of frames written.
+    uint32_t finish();
+
+    inline uint32_t framesWritten() const { return m_written; }
+    inline uint32_t framesDropped() const { return m_dropped; }
+
+  private:
+    struct Pending {
+        int slot; // -1 tells the writer to stop
+        FrameMetadata metadata;
+    };
+
+    const uint8_t *mapSource(int fd, size_t length);
+    void writer();
+
+    int m_height;
+    unsigned int m_stride;
+    uint32_t m_frameSize;
+    uint64_t m_frameStride; // frameSize, rounded up to a page
+
+    int m_fd;
+    uint8_t *m_file;
+    size_t m_fileSize;
+    CaptureFileHeader *m_header;
+    CaptureFrameIndex *m_index;
+
+    std::vector<uint8_t> m_ring;
+    // writer -> record()
+    SpscQueue<int> m_free;
+    // record() -> writer
+    SpscQueue<Pending> m_pending;
+    uint32_t m_queued = 0;
+
+    // (dma_buf fd, (mapping, length)), only touched by record()
+    std::unordered_map<int, std::pair<uint8_t *, size_t>> m_sources;
+
+    std::atomic<uint32_t> m_written = 0;
+    std::atomic<uint32_t> m_dropped = 0;
+
+    std::thread m_writer;
+};
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Split packed 4 byte pixels into a 3 byte plane (bytes 0-2, which is
+ * BGR for our shader output) and a 1 byte plane (byte 3, the processed
+ * result), in a single pass over the input.
+ *
+ * Uses NEON on ARM and SSSE3 on x86 when available.
+ *
+ * @param in Packed input, 4 * pixels bytes
+ * @param color Output, 3 * pixels bytes, or null to skip the color plane
+ * @param alpha Output, pixels bytes, or null to skip the alpha plane
+ * @param pixels Number of pixels to convert
+ */
+void deinterleaveColorAlpha(const uint8_t *in, uint8_t *color, uint8_t *alpha,
+                            size_t pixels);
+
+// Plain C++ version of the above, which the vectorized versions must match
+// bit for bit
+void deinterleaveColorAlphaScalar(const uint8_t *in, uint8_t *color,
+                                  uint8_t *alpha, size_t pixels);
+
+/**
+ * @brief Split packed 4 byte pixels into 4 separate 1 byte planes, one per
+ * byte, in a single pass over the input. For ProcessType::Multi, where every
+ * byte is a different result.
+ *
+ * @param in Packed input, 4 * pixels bytes
+ * @param planes Outputs, pixels bytes each, or null to skip that byte
+ * @param pixels Number of pixels to convert
+ */
+void deinterleavePlanes(const uint8_t *in, uint8_t *const planes[4],
+                        size_t pixels);
+
+// Plain C++ version of the above
+void deinterleavePlanesScalar(const uint8_t *in, uint8_t *const planes[4],
+                              size_t pixels);
@@ -18,6 +18,8 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <string>
 
 class DmaBufAlloc {
@@ -32,3 +34,29 @@ class DmaBufAlloc {
   private:
     int m_heap_fd;
 };
+
+// Allocates DMA-BUFs backed by ordinary shared memory through /dev/udmabuf.
+// Useful where there are no dma-heaps to allocate from, like an x86 box
+// without a GPU.
+class UdmabufAlloc {
+  public:
+    UdmabufAlloc();
+    ~UdmabufAlloc();
+
+    // Allocates a DMA-BUF of at least size len, rounded up to a whole
+    // number of pages. The returned fd can be closed using `close`.
+    int alloc_buf_fd(size_t len);
+
+  private:
+    int m_udmabuf_fd;
+};
+
+// Returns an allocator for the first of the CMA heap, the system heap or
+// udmabuf that's available here. The returned fds can be closed using `close`.
+std::function<int(size_t)> makeAnyDmaBufAllocator();
+
+// Brackets CPU access to a mapped DMA-BUF, with DMA_BUF_SYNC_START or
+// DMA_BUF_SYNC_END and the access flags. Throws if the sync fails.
+void syncDmaBuf(int fd, uint64_t flags);
+// The same, for where throwing isn't an option. Returns false on failure.
+bool trySyncDmaBuf(int fd, uint64_t flags) noexcept;
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <libcamera/color_space.h>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "camera_model.h"
+#include "seqlock.h"
+
+// A rectangle on the sensor, in pixels
+struct CropRect {
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+
+    bool operator==(const CropRect &) const = default;
+};
+
+struct CameraSettings {
+    int32_t exposureTimeUs = 10000;
+    float analogGain = 2;
+    float brightness = 0.0;
+    float contrast = 1;
+    float awbRedGain = 1.5;
+    float awbBlueGain = 1.5;
+    float saturation = 1;
+    bool doAutoExposure = false;
+    // Grow the region of interest to the output's aspect ratio, so it's
+    // zoomed into rather than stretched to fill the output
+    bool roiKeepAspect = true;
+    // float digitalGain = 100;
+    // Range the sensor may vary its frame duration over, in microseconds.
+    // Equal values lock the frame rate; otherwise it follows exposure.
+    int64_t minFrameDurationUs = 1e6 / 120;
+    int64_t maxFrameDurationUs = 1e6 / 1;
+    // Part of the sensor to capture, in the coordinates of
+    // FrameSource::scalerCropMaximum(). The output size stays the same, so a
+    // smaller region puts more pixels on it. A zero size captures everything.
+    CropRect roi{};
+
+    bool operator==(const CameraSettings &) const = default;
+};
+
+// One plane of a YUV420 buffer, as a region of a dma-buf
+struct FramePlane {
+    int fd;
+    unsigned int offset;
+    unsigned int length;
+    unsigned int stride;
+};
+
+// Y, U and V planes, in that order
+using YuvBuffer = std::array<FramePlane, 3>;
+
+struct FrameMetadata {
+    // CLOCK_BOOTTIME nanoseconds at the start of exposure, or 0 if unknown
+    uint64_t sensorTimestamp;
+    // 0 if unknown
+    int32_t exposureTimeUs;
+    // 0 if unknown
+    float analogGain;
+    uint32_t sequence;
+    // Part of the sensor the frame was scaled from, or all 0 if unknown
+    CropRect scalerCrop;
+};
+
+struct Frame {
+    // Which of FrameSource::buffers() holds this frame
+    int bufferIndex;
+    FrameMetadata metadata;
+};
+
+// Something that fills a fixed set of YUV420 dma-bufs with frames, and hands
+// each one to onData until it is given back with requeue.
+class FrameSource {
+  public:
+    virtual ~FrameSource() = default;
+
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+    virtual const std::vector<YuvBuffer> &buffers() const = 0;
+    // A second, full resolution stream captured alongside buffers(), for
+    // sources where buffers() is scaled down for processing.
+    // fullResBuffers()[i] is the same frame as buffers()[i]. Empty, with a
+    // size of 0, if the source has only the one stream.
+    virtual const std::vector<YuvBuffer> &fullResBuffers() const {
+        static const std::vector<YuvBuffer> none;
+        return none;
+    }
+    virtual int fullResWidth() const { return 0; }
+    virtual int fullResHeight() const { return 0; }
+    virtual libcamera::ColorSpace colorSpace() const = 0;
+    virtual CameraModel model() const = 0;
+
+    // Shortest and longest frame duration the source can be asked for, in
+    // microseconds, or nullopt if its frame rate can't be controlled
+    virtual std::optional<std::pair<int64_t, int64_t>>
+    frameDurationLimits() const {
+        return std::nullopt;
+    }
+
+    // The largest region of interest, covering the whole field of view, or
+    // nullopt if the source can't crop
+    virtual std::optional<CropRect> scalerCropMaximum() const {
+        return std::nullopt;
+    }
+
+    // Settings can be changed from any thread. Each change is published as a
+    // whole, and takes effect from the next request queued.
+    CameraSettings cameraSettings() const { return m_settings.load(); }
+    void setCameraSettings(const CameraSettings &settings) {
+        m_settings.store(settings);
+    }
+    // Applies `modify` to the current settings and publishes the result
+    template <typename F> void updateSettings(F &&modify) {
+        m_settings.update(std::forward<F>(modify));
+    }
+
+    // Called from the source's own thread with each new frame
+    void setOnData(std::function<void(const Frame &)> onData) {
+        m_onData = std::move(onData);
+    }
+    void resetOnData() { m_onData.reset(); }
+
+    // Note: these 3 functions must be protected by mutual exclusion.
+    // Failure to do so will result in UB.
+    virtual bool startAndQueue() = 0;
+    virtual void stop() = 0;
+    virtual void requeue(const Frame &frame) = 0;
+
+  protected:
+    std::optional<std::function<void(const Frame &)>> m_onData;
+    SeqLock<CameraSettings> m_settings;
+};
@@ -20,7 +20,9 @@
 #include <stdint.h>
 
 #include <array>
+#include <atomic>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <queue>
@@ -30,19 +32,62 @@
 #include <vector>
 
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GLES2/gl2.h>
 
 #include "camera_model.h"
-#include "headless_opengl.h"
+#include "gpu_context.h"
 
 enum class ProcessType : int32_t {
     None = 0,
     Hsv,
     Gray,
     Adaptive,
+    // Every result at once, packed in the output as (HSV range 0 mask, HSV
+    // range 1 mask, gray, adaptive). One channel output only has room for
+    // adaptive.
+    Multi,
+    // Several HSV ranges at once, encoded per GlHsvThresholder::setHsvRanges
+    HsvRanges,
     NUM_PROCESS_TYPES
 };
 
+// How ProcessType::HsvRanges encodes which ranges a pixel is in
+enum class HsvEncoding : int32_t {
+    // Range i sets bit i
+    Bitmask = 0,
+    // The label of the first range the pixel is in, or 0 for none
+    Label,
+};
+
+struct HsvRange {
+    float lower[3]; // Hue, sat, value, in [0,1]
+    float upper[3]; // Hue, sat, value, in [0,1]
+    bool invertHue;
+    // Only used by HsvEncoding::Label, where 0 is reserved for no match
+    uint8_t label;
+};
+
+// What a CameraRunner hands out for each frame
+enum class OutputFormat : int32_t {
+    // BGR color (gray from a mono sensor) plus the processed result
+    ColorAndProcessed = 0,
+    // Just the processed result, rendered at one byte per pixel
+    ProcessedOnly,
+    // Just gray, copied from the camera's Y plane without using the GPU
+    Gray,
+    // Just BGR color
+    Bgr,
+    // BGR color with the processed result as alpha, as rendered, in one Mat
+    Bgra,
+    // The camera's frame untouched, as I420, without using the GPU
+    Yuv420,
+    NUM_OUTPUT_FORMATS
+};
+
+// Whether frames in `format` are rendered by GlHsvThresholder at all
+bool usesGpu(OutputFormat format);
+
 class GlHsvThresholder {
   public:
     struct DmaBufPlaneData {
@@ -51,16 +96,37 @@ class GlHsvThresholder {
         EGLint pitch;
     };
 
-    explicit GlHsvThresholder(int width, int height, CameraModel model);
+    // An output buffer that has been queued for rendering. The GPU may still
+    // be writing to it; call waitForRender before touching its contents.
+    struct RenderedFrame {
+        int fd;
+        EGLSyncKHR fence;
+        int fence_fd; // native fence fd, or -1 if we fell back to `fence`
+    };
+
+    explicit GlHsvThresholder(
+        int width, int height, CameraModel model,
+        OutputFormat format = OutputFormat::ColorAndProcessed);
     ~GlHsvThresholder();
 
-    void start(const std::vector<int> &output_buf_fds);
+    // Imports the output buffers as render targets, and the (fixed) set of
+    // input buffers as external textures so testFrame doesn't have to
+    // re-import them every frame. Output buffers in `busy` are still being
+    // read, and aren't rendered into until they're returned.
+    void start(const std::vector<int> &output_buf_fds,
+               const std::vector<std::array<DmaBufPlaneData, 3>> &input_bufs,
+               EGLint encoding, EGLint range,
+               const std::vector<int> &busy = {});
     void release();
 
     void returnBuffer(int fd);
-    int testFrame(
+    // Returns a frame with fd 0 if there is no free output buffer
+    RenderedFrame testFrame(
         const std::array<GlHsvThresholder::DmaBufPlaneData, 3> &yuv_plane_data,
         EGLint encoding, EGLint range, ProcessType type);
+    // Blocks until the GPU has finished rendering `frame`, and releases its
+    // fence. Safe to call from a thread without our context current.
+    void waitForRender(const RenderedFrame &frame);
 
     /**
      * @brief Set the Hsv Thresholds range, on [0..1]
@@ -75,29 +141,64 @@ class GlHsvThresholder {
      */
     void setHsvThresholds(double hl, double sl, double vl, double hu, double su,
                           double vu, bool hueInverted);
+    // The same, for any of the ranges ProcessType::Multi or HsvRanges masks
+    // with. Range 0 is the one setHsvThresholds sets. Throws if there's no
+    // such range.
+    void setHsvRange(int range, double hl, double sl, double vl, double hu,
+                     double su, double vu, bool hueInverted);
+    // Replaces the ranges ProcessType::HsvRanges checks, starting from range
+    // 0. Throws if there are more than MAX_HSV_RANGES, or a label is 0.
+    void setHsvRanges(const std::vector<HsvRange> &ranges,
+                      HsvEncoding encoding);
+    static constexpr int MULTI_HSV_RANGES = 2;
+    // One per bit of the output
+    static constexpr int MAX_HSV_RANGES = 8;
+
+    // For grayscale sensors, only the Y plane is sampled
+    inline bool mono() const { return m_mono; }
+    // Whether output buffers hold just the processed result, one byte per
+    // pixel, rather than BGR plus the result in alpha. Mono sensors' color
+    // is copied from the camera instead, so they always render this way.
+    inline bool resultOnly() const { return m_resultOnly; }
+    inline int outputChannels() const { return m_resultOnly ? 1 : 4; }
 
   private:
+    GLuint importInput(
+        const std::array<GlHsvThresholder::DmaBufPlaneData, 3> &yuv_plane_data,
+        EGLint encoding, EGLint range);
+    RenderedFrame fenceFrame(int framebuffer_fd);
+
     int m_width;
     int m_height;
-    bool useGrayScalePassThrough;
+    bool m_mono;
+    bool m_resultOnly;
 
     std::unordered_map<int, GLuint> m_framebuffers; // (dma_buf fd, framebuffer)
+    std::vector<GLuint> m_output_textures;
+    // ((plane 0 fd, plane 0 offset), external texture)
+    std::unordered_map<uint64_t, GLuint> m_input_textures;
     std::queue<int> m_renderable;
     std::mutex m_renderable_mutex;
 
-    GLuint m_quad_vbo = 0;
+    GLuint m_quad_vbo = 0; // shared, owned by m_gpu
     GLuint m_grayscale_texture = 0;
     GLuint m_grayscale_buffer = 0;
     GLuint m_min_max_texture = 0;
     GLuint m_min_max_framebuffer = 0;
-    std::vector<GLuint> m_programs = {};
+    std::vector<GlProgram> m_programs = {};
 
-    HeadlessData m_status;
+    std::shared_ptr<GpuContext> m_gpu;
     EGLDisplay m_display;
     EGLContext m_context;
+    bool m_hasNativeFence = false;
+    bool m_hasFenceSync = false;
 
+    // Uniforms only get uploaded when m_hsvGeneration moves on from what
+    // the program last saw
+    std::atomic<uint64_t> m_hsvGeneration = 1;
     std::mutex m_hsv_mutex;
-    double m_hsvLower[3] = {0}; // Hue, sat, value, in [0,1]
-    double m_hsvUpper[3] = {0}; // Hue, sat, value, in [0,1]
-    bool m_invertHue;
+    std::array<HsvRange, MAX_HSV_RANGES> m_hsvRanges{};
+    // How many of m_hsvRanges ProcessType::HsvRanges checks
+    int m_hsvRangeCount = 1;
+    HsvEncoding m_hsvEncoding = HsvEncoding::Bitmask;
 };
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include <GLES2/gl2.h>
+
+// A linked program, with the locations of everything our shaders use looked
+// up once rather than every frame. Anything a program doesn't use is -1,
+// which glUniform* quietly ignores.
+struct GlProgram {
+    explicit GlProgram(GLuint program)
+        : id(program), vertex(glGetAttribLocation(program, "vertex")),
+          tex(glGetUniformLocation(program, "tex")),
+          tiles(glGetUniformLocation(program, "tiles")),
+          lowerThresh(glGetUniformLocation(program, "lowerThresh")),
+          upperThresh(glGetUniformLocation(program, "upperThresh")),
+          invertHue(glGetUniformLocation(program, "invertHue")),
+          hsvValues(glGetUniformLocation(program, "hsvValues")),
+          hsvRangeCount(glGetUniformLocation(program, "hsvRangeCount")),
+          hsvBitmask(glGetUniformLocation(program, "hsvBitmask")),
+          resolutionIn(glGetUniformLocation(program, "resolution_in")),
+          tileResolution(glGetUniformLocation(program, "tile_resolution")) {}
+
+    // Returns true if the uniforms for `generation` of the caller's
+    // settings still need uploading, and records that they're about to be
+    bool claimUniforms(uint64_t generation) {
+        if (uniformsGeneration == generation) {
+            return false;
+        }
+        uniformsGeneration = generation;
+        return true;
+    }
+
+    GLuint id;
+    GLint vertex;
+    // Samplers, bound to texture units 0 and 1 when the program is created
+    GLint tex;
+    GLint tiles;
+    GLint lowerThresh;
+    GLint upperThresh;
+    GLint invertHue;
+    GLint hsvValues;
+    GLint hsvRangeCount;
+    GLint hsvBitmask;
+    GLint resolutionIn;
+    GLint tileResolution;
+
+  private:
+    uint64_t uniformsGeneration = 0;
+};
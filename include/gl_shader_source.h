@@ -17,6 +17,11 @@
 
 #pragma once
 
+// All fragment shaders but the tiling one are compiled with these macros
+// defined ahead of them: INPUT, the swizzle that gets color from the camera
+// frame (rrr when it's only a mono sensor's Y plane), OUTPUT(color, result),
+// which writes a pixel in the output buffer's layout, and MAX_HSV_RANGES.
+
 // clang-format off
 
 static constexpr const char *VERTEX_SOURCE =
@@ -43,11 +48,37 @@ static constexpr const char *NONE_FRAGMENT_SOURCE =
         "uniform samplerExternalOES tex;"
         ""
         "void main(void) {"
-        "    vec3 color = texture2D(tex, texcoord).rgb;"
-        "    gl_FragColor = vec4(color.bgr, 0);"
+        "    vec3 color = texture2D(tex, texcoord).INPUT;"
+        "    OUTPUT(color, 0.0);"
         "}";
 
 
+// Shared by the single and multi range HSV shaders
+#define HSV_FUNCTIONS_SOURCE \
+        "vec3 rgb2hsv(const vec3 p) {" \
+        "  const vec4 H = vec4(0.0, -1.0 / 3.0, 2.0 / 3.0, -1.0);" \
+        /* Using ternary seems to be faster than using mix and step */ \
+        "  vec4 o = mix(vec4(p.bg, H.wz), vec4(p.gb, H.xy), step(p.b, p.g));" \
+        "  vec4 t = mix(vec4(o.xyw, p.r), vec4(p.r, o.yzx), step(o.x, p.r));" \
+        "" \
+        "  float O = t.x - min(t.w, t.y);" \
+        "  const float n = 1.0e-10;" \
+        "  return vec3(abs(t.z + (t.w - t.y) / (6.0 * O + n)), O / (t.x + n), " \
+        "t.x);" \
+        "}" \
+        "" \
+        "bool inRange(vec3 hsv, vec3 lower, vec3 upper, bool invert) {" \
+        "  const float epsilon = 0.0001;" \
+        "  bvec3 botBool = greaterThanEqual(hsv, lower - epsilon);" \
+        "  bvec3 topBool = lessThanEqual(hsv, upper + epsilon);" \
+        "  if (invert) {" \
+        "    return !(botBool.x && topBool.x) && all(botBool.yz) && all(topBool.yz);" \
+        "  } else {" \
+        "    return all(botBool) && all(topBool);" \
+        "  }" \
+        "}"
+
+
 static constexpr const char *HSV_FRAGMENT_SOURCE =
         "#version 100\n"
         "#extension GL_OES_EGL_image_external : require\n"
@@ -62,32 +93,86 @@ static constexpr const char *HSV_FRAGMENT_SOURCE =
         "uniform bool invertHue;"
         "uniform samplerExternalOES tex;"
         ""
-        "vec3 rgb2hsv(const vec3 p) {"
-        "  const vec4 H = vec4(0.0, -1.0 / 3.0, 2.0 / 3.0, -1.0);"
-        // Using ternary seems to be faster than using mix and step
-        "  vec4 o = mix(vec4(p.bg, H.wz), vec4(p.gb, H.xy), step(p.b, p.g));"
-        "  vec4 t = mix(vec4(o.xyw, p.r), vec4(p.r, o.yzx), step(o.x, p.r));"
+        HSV_FUNCTIONS_SOURCE
         ""
-        "  float O = t.x - min(t.w, t.y);"
-        "  const float n = 1.0e-10;"
-        "  return vec3(abs(t.z + (t.w - t.y) / (6.0 * O + n)), O / (t.x + n), "
-        "t.x);"
-        "}"
+        "void main(void) {"
+        "  vec3 col = texture2D(tex, texcoord).INPUT;"
+        "  OUTPUT(col, float(inRange(rgb2hsv(col), lowerThresh, upperThresh, invertHue)));"
+        "}";
+
+
+// The first pass of ProcessType::Multi, into the intermediate texture that
+// the adaptive threshold passes read gray from (alpha). The thresholding
+// pass then writes the output bytes as (range 0 mask, range 1 mask, gray,
+// adaptive).
+static constexpr const char *MULTI_FRAGMENT_SOURCE =
+        "#version 100\n"
+        "#extension GL_OES_EGL_image_external : require\n"
         ""
-        "bool inRange(vec3 hsv) {"
-        "  const float epsilon = 0.0001;"
-        "  bvec3 botBool = greaterThanEqual(hsv, lowerThresh - epsilon);"
-        "  bvec3 topBool = lessThanEqual(hsv, upperThresh + epsilon);"
-        "  if (invertHue) {"
-        "    return !(botBool.x && topBool.x) && all(botBool.yz) && all(topBool.yz);"
-        "  } else {"
-        "    return all(botBool) && all(topBool);"
-        "  }"
-        "}"
+        "precision lowp float;"
+        "precision lowp int;"
+        ""
+        "varying vec2 texcoord;"
+        ""
+        "uniform vec3 lowerThresh[2];"
+        "uniform vec3 upperThresh[2];"
+        "uniform bool invertHue[2];"
+        "uniform samplerExternalOES tex;"
+        ""
+        HSV_FUNCTIONS_SOURCE
         ""
         "void main(void) {"
-        "  vec3 col = texture2D(tex, texcoord).rgb;"
-        "  gl_FragColor = vec4(col.bgr, int(inRange(rgb2hsv(col))));"
+        "  vec3 col = texture2D(tex, texcoord).INPUT;"
+        "  vec3 hsv = rgb2hsv(col);"
+        "  float a = float(inRange(hsv, lowerThresh[0], upperThresh[0], invertHue[0]));"
+        "  float b = float(inRange(hsv, lowerThresh[1], upperThresh[1], invertHue[1]));"
+        "  vec3 linear = pow(col, vec3(2.0));"
+        "  float gray = sqrt(dot(linear, vec3(0.2126, 0.7152, 0.0722)));"
+        // Backwards, since thresholding swaps color from RGB to BGR
+        "  gl_FragColor = vec4(gray, b, a, gray);"
+        "}";
+
+
+// ProcessType::HsvRanges: every range is checked against one conversion to
+// HSV. With hsvBitmask the result is the sum of the matching ranges' bits,
+// otherwise it's the label of the first range that matches, or 0.
+static constexpr const char *HSV_RANGES_FRAGMENT_SOURCE =
+        "#version 100\n"
+        "#extension GL_OES_EGL_image_external : require\n"
+        ""
+        "precision lowp float;"
+        "precision lowp int;"
+        ""
+        "varying vec2 texcoord;"
+        ""
+        "uniform vec3 lowerThresh[MAX_HSV_RANGES];"
+        "uniform vec3 upperThresh[MAX_HSV_RANGES];"
+        "uniform bool invertHue[MAX_HSV_RANGES];"
+        // Each range's bit or label, over 255. lowp can't hold those exactly.
+        "uniform mediump float hsvValues[MAX_HSV_RANGES];"
+        "uniform int hsvRangeCount;"
+        "uniform bool hsvBitmask;"
+        "uniform samplerExternalOES tex;"
+        ""
+        HSV_FUNCTIONS_SOURCE
+        ""
+        "void main(void) {"
+        "  vec3 col = texture2D(tex, texcoord).INPUT;"
+        "  vec3 hsv = rgb2hsv(col);"
+        "  mediump float result = 0.0;"
+        "  for (int i = 0; i < MAX_HSV_RANGES; i++) {"
+        "    if (i >= hsvRangeCount) {"
+        "      break;"
+        "    }"
+        "    if (inRange(hsv, lowerThresh[i], upperThresh[i], invertHue[i])) {"
+        "      if (hsvBitmask) {"
+        "        result += hsvValues[i];"
+        "      } else if (result == 0.0) {"
+        "        result = hsvValues[i];"
+        "      }"
+        "    }"
+        "  }"
+        "  OUTPUT(col, result);"
         "}";
 
 
@@ -104,8 +189,8 @@ static constexpr const char *GRAY_PASSTHROUGH_FRAGMENT_SOURCE =
         ""
         "void main(void) {"
         // We get in (gray, gray, gray), I think. So just copy the R channel
-        "    vec3 gray_gray_gray = texture2D(tex, texcoord).rgb;"
-        "    gl_FragColor = vec4(gray_gray_gray.bgr, gray_gray_gray[0]);"
+        "    vec3 gray_gray_gray = texture2D(tex, texcoord).INPUT;"
+        "    OUTPUT(gray_gray_gray, gray_gray_gray[0]);"
         "}";
 
 
@@ -121,11 +206,11 @@ static constexpr const char *GRAY_FRAGMENT_SOURCE =
         "uniform samplerExternalOES tex;"
         ""
         "void main(void) {"
-        "    vec3 gammaColor = texture2D(tex, texcoord).rgb;"
+        "    vec3 gammaColor = texture2D(tex, texcoord).INPUT;"
         "    vec3 color = pow(gammaColor, vec3(2.0));"
         "    float gray = dot(color, vec3(0.2126, 0.7152, 0.0722));"
         "    float gammaGray = sqrt(gray);"
-        "    gl_FragColor = vec4(color.bgr, gammaGray);"
+        "    OUTPUT(color, gammaGray);"
         "}";
 
 
@@ -184,7 +269,7 @@ static constexpr const char *THRESHOLDING_FRAGMENT_SOURCE =
         "    float mean = min_so_far + (max_so_far - min_so_far) / 2.0;"
         "    output_ = step(mean, gray);"
         "  }"
-        "  gl_FragColor = vec4(color.bgr, output_);"
+        "  OUTPUT(color, output_);"
         "}";
 
 // clang-format on
@@ -25,7 +25,13 @@
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
 
+// glGetError can stall until the driver catches up, so checking after every
+// GL call is only done in builds with PHOTON_GL_ERROR_CHECKS
+#ifdef PHOTON_GL_ERROR_CHECKS
 #define GLERROR() glerror(__LINE__)
+#else
+#define GLERROR() ((void)0)
+#endif
 #define EGLERROR() eglerror(__LINE__)
 
 inline void glerror(int line) {
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+
+#include "gl_program.h"
+#include "headless_opengl.h"
+#include "program_cache.h"
+
+GLuint make_shader(GLenum type, const char *source);
+// Links the shaders into a new program, leaving them for the caller to delete
+GLuint link_program(GLuint vertex_shader, GLuint fragment_shader);
+GLuint make_program(const char *vertex_source, const char *fragment_source);
+
+// The one EGL display (and GBM device) every camera in the process renders
+// with. Each camera gets its own context, but all of them are in one share
+// group, so shaders and the quad VBO are only built once. Each camera links
+// its own programs from them, as uniforms live in the program.
+class GpuContext {
+  public:
+    // Returns the process's GPU context, setting it up if nobody else is
+    // using it. It's torn down when the last user drops it.
+    static std::shared_ptr<GpuContext> acquire();
+    ~GpuContext();
+
+    GpuContext(const GpuContext &) = delete;
+    GpuContext &operator=(const GpuContext &) = delete;
+
+    // Where compiled programs are cached between runs, or "" to not cache
+    // them. Takes effect the next time the context is set up.
+    static void setProgramCacheDirectory(const std::string &directory);
+
+    inline EGLDisplay display() const { return m_headless.display; }
+
+    // A new context in the share group, for one camera's render thread
+    EGLContext createContext();
+    void destroyContext(EGLContext context);
+
+    // A new program for the calling camera alone, loaded from the program
+    // cache or linked from the shared shaders, with its samplers bound to
+    // texture units 0 and 1. The caller deletes it. One of our contexts must
+    // be current.
+    GlProgram program(const std::string &vertexSource,
+                      const std::string &fragmentSource);
+    // Shared, built the first time it's asked for
+    GLuint quadVbo();
+
+  private:
+    GpuContext();
+
+    // Its context is never made current, except to tear down; it only roots
+    // the share group
+    HeadlessData m_headless;
+
+    std::mutex m_mutex;
+    ProgramCache m_cache;
+    // ((type, source), shader), compiled the first time they're linked
+    std::map<std::pair<GLenum, std::string>, GLuint> m_shaders;
+    GLuint m_quadVbo = 0;
+};
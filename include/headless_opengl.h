@@ -28,11 +28,14 @@ struct HeadlessData {
     struct gbm_device *gbmDevice;
 
     EGLDisplay display;
+    EGLConfig config;
     EGLContext context;
 };
 
 struct HeadlessData createHeadless(void);
 void destroyHeadless(struct HeadlessData status);
+// A new context on the same display, sharing objects with status.context
+EGLContext createSharedContext(struct HeadlessData status);
 
 #ifdef __cplusplus
 } // extern "C"
@@ -42,6 +42,11 @@ Java_org_photonvision_raspi_LibCameraJNI_getSensorModelRaw(JNIEnv *, jclass,
 JNIEXPORT jboolean JNICALL
 Java_org_photonvision_raspi_LibCameraJNI_isLibraryWorking(JNIEnv *, jclass);
 
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_setShaderCacheDirectory(JNIEnv *,
+                                                                 jclass,
+                                                                 jstring);
+
 /*
  * Class:     test
  * Method:    getCameraNames
@@ -58,6 +63,35 @@ Java_org_photonvision_raspi_LibCameraJNI_getCameraNames(JNIEnv *, jclass);
 JNIEXPORT jlong JNICALL Java_org_photonvision_raspi_LibCameraJNI_createCamera(
     JNIEnv *, jclass, jstring, jint, jint, jint);
 
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    createCameraWithOptions
+ * Signature: (Ljava/lang/String;IIIIIZIIIIII)J
+ */
+JNIEXPORT jlong JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_createCameraWithOptions(
+    JNIEnv *, jclass, jstring, jint, jint, jint, jint, jint, jboolean, jint,
+    jint, jint, jint, jint, jint);
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    getSensorModesRaw
+ * Signature: (Ljava/lang/String;)[D
+ */
+JNIEXPORT jdoubleArray JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_getSensorModesRaw(JNIEnv *, jclass,
+                                                           jstring);
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    createReplayCamera
+ * Signature: (Ljava/lang/String;DZ)J
+ */
+JNIEXPORT jlong JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_createReplayCamera(JNIEnv *, jclass,
+                                                            jstring, jdouble,
+                                                            jboolean);
+
 JNIEXPORT jboolean JNICALL
 Java_org_photonvision_raspi_LibCameraJNI_startCamera(JNIEnv *, jclass, jlong);
 
@@ -84,6 +118,18 @@ Java_org_photonvision_raspi_LibCameraJNI_setThresholds(JNIEnv *, jclass, jlong,
                                                        jdouble, jdouble,
                                                        jboolean);
 
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_setHsvRange(JNIEnv *, jclass, jlong,
+                                                     jint, jdouble, jdouble,
+                                                     jdouble, jdouble, jdouble,
+                                                     jdouble, jboolean);
+
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_setHsvRanges(JNIEnv *, jclass, jlong,
+                                                      jdoubleArray,
+                                                      jbooleanArray,
+                                                      jintArray, jboolean);
+
 /*
  * Class:     org_photonvision_raspi_LibCameraJNI
  * Method:    setExposure
@@ -126,6 +172,35 @@ Java_org_photonvision_raspi_LibCameraJNI_setAnalogGain(JNIEnv *, jclass, jlong,
 JNIEXPORT jboolean JNICALL Java_org_photonvision_raspi_LibCameraJNI_setAwbGain(
     JNIEnv *, jclass, jlong, jdouble red, jdouble blue);
 
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    setCameraSettings
+ * Signature: (JZIDDDDDD)Z
+ */
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_setCameraSettings(
+    JNIEnv *, jclass, jlong, jboolean, jint, jdouble, jdouble, jdouble, jdouble,
+    jdouble, jdouble);
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    setFrameDurationLimits
+ * Signature: (JJJ)Z
+ */
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_setFrameDurationLimits(JNIEnv *,
+                                                                jclass, jlong,
+                                                                jlong, jlong);
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    getFrameDurationLimits
+ * Signature: (J)[J
+ */
+JNIEXPORT jlongArray JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_getFrameDurationLimits(JNIEnv *,
+                                                                jclass, jlong);
+
 JNIEXPORT jlong JNICALL
 Java_org_photonvision_raspi_LibCameraJNI_getLibcameraTimestamp(JNIEnv *,
                                                                jclass);
@@ -138,6 +213,32 @@ JNIEXPORT jlong JNICALL
 Java_org_photonvision_raspi_LibCameraJNI_getFrameExposureTimeUs(JNIEnv *,
                                                                 jclass, jlong);
 
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    getPipelineStats
+ * Signature: (J)[J
+ */
+JNIEXPORT jlongArray JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_getPipelineStats(JNIEnv *, jclass,
+                                                          jlong);
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    startRecording
+ * Signature: (JLjava/lang/String;I)Z
+ */
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_startRecording(JNIEnv *, jclass, jlong,
+                                                        jstring, jint);
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    stopRecording
+ * Signature: (J)J
+ */
+JNIEXPORT jlong JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_stopRecording(JNIEnv *, jclass, jlong);
+
 /*
  * Class:     org_photonvision_raspi_LibCameraJNI
  * Method:    grabFrame
@@ -153,11 +254,45 @@ JNIEXPORT jlong JNICALL
 Java_org_photonvision_raspi_LibCameraJNI_takeProcessedFrame(JNIEnv *, jclass,
                                                             jlong);
 
+JNIEXPORT jlong JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_takeProcessedPlane(JNIEnv *, jclass,
+                                                            jlong, jint);
+
+JNIEXPORT jlong JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_takeFullResFrame(JNIEnv *, jclass,
+                                                          jlong);
+
 JNIEXPORT jboolean JNICALL
 Java_org_photonvision_raspi_LibCameraJNI_setFramesToCopy(JNIEnv *, jclass,
                                                          jlong, jboolean copyIn,
                                                          jboolean copyOut);
 
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_setRegionOfInterest(JNIEnv *, jclass,
+                                                             jlong, jint, jint,
+                                                             jint, jint,
+                                                             jboolean);
+
+JNIEXPORT jintArray JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_getScalerCropMaximum(JNIEnv *, jclass,
+                                                              jlong);
+
+JNIEXPORT jintArray JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_getFrameScalerCrop(JNIEnv *, jclass,
+                                                            jlong);
+
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_setCopyFullRes(JNIEnv *, jclass,
+                                                        jlong, jboolean);
+
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_setZeroCopy(JNIEnv *, jclass, jlong,
+                                                     jboolean, jboolean);
+
+JNIEXPORT jint JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_getLeasesOutstanding(JNIEnv *, jclass,
+                                                              jlong);
+
 JNIEXPORT jint JNICALL
 Java_org_photonvision_raspi_LibCameraJNI_getGpuProcessType(JNIEnv *, jclass,
                                                            jlong);
@@ -169,6 +304,29 @@ Java_org_photonvision_raspi_LibCameraJNI_setGpuProcessType(JNIEnv *, jclass,
 JNIEXPORT jboolean JNICALL Java_org_photonvision_raspi_LibCameraJNI_releasePair(
     JNIEnv *env, jclass, jlong pair_);
 
+JNIEXPORT jlong JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_createCameraGroup(JNIEnv *, jclass,
+                                                           jlongArray, jlong);
+
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_startCameraGroup(JNIEnv *, jclass,
+                                                          jlong);
+
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_stopCameraGroup(JNIEnv *, jclass,
+                                                         jlong);
+
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_destroyCameraGroup(JNIEnv *, jclass,
+                                                            jlong);
+
+JNIEXPORT jlongArray JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_awaitFrameSet(JNIEnv *, jclass, jlong);
+
+JNIEXPORT jlongArray JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_getCameraGroupStats(JNIEnv *, jclass,
+                                                             jlong);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// A fixed number of preallocated, same-sized buffers that cv::Mats can be
+// created in. A buffer goes back to the pool when the last Mat referencing it
+// is released, from whichever thread that happens on. When every buffer is in
+// use (or the Mat doesn't fit), Mats fall back to the default heap allocator.
+//
+// The pool keeps itself alive while any of its buffers are still out, so
+// Mats handed to Java may outlive the CameraRunner that made them.
+class MatPool : public cv::MatAllocator,
+                public std::enable_shared_from_this<MatPool> {
+  public:
+    static std::shared_ptr<MatPool> make(size_t bufferSize, int count);
+    ~MatPool() override;
+
+    MatPool(const MatPool &) = delete;
+    MatPool &operator=(const MatPool &) = delete;
+
+    cv::Mat mat(int rows, int cols, int type);
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data,
+                           size_t *step, cv::AccessFlag flags,
+                           cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData *data, cv::AccessFlag accessflags,
+                  cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData *data) const override;
+
+  private:
+    MatPool(size_t bufferSize, int count);
+
+    // Storage for the UMatData header of each buffer, so handing out a Mat
+    // doesn't have to allocate one
+    struct Header {
+        alignas(cv::UMatData) unsigned char storage[sizeof(cv::UMatData)];
+    };
+
+    size_t m_bufferSize;
+    uint8_t *m_buffers;
+    mutable std::vector<Header> m_headers;
+
+    mutable std::mutex m_mutex;
+    mutable std::vector<int> m_free;
+    mutable std::shared_ptr<const MatPool> m_keepAlive;
+};
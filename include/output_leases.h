@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// A runner's output buffers, mapped once, that cv::Mats can view in place of
+// a copy. A leased buffer is handed to the return function set by attach()
+// when the last Mat viewing it is released, from whichever thread that
+// happens on, so the GPU can render into it again.
+//
+// Like MatPool, this keeps itself (and so its mappings) alive while any
+// lease is still out, so Mats handed to Java may outlive the CameraRunner.
+class OutputLeases : public cv::MatAllocator,
+                     public std::enable_shared_from_this<OutputLeases> {
+  public:
+    // Maps `size` bytes of each of `fds`. They are duplicated, so the caller
+    // can close its own while leases are still out; buffers are still named
+    // by the caller's fd numbers everywhere else.
+    static std::shared_ptr<OutputLeases> make(const std::vector<int> &fds,
+                                              size_t size);
+    ~OutputLeases() override;
+
+    OutputLeases(const OutputLeases &) = delete;
+    OutputLeases &operator=(const OutputLeases &) = delete;
+
+    // Where `fd` is mapped, for copying out of
+    uint8_t *data(int fd) const;
+
+    // A Mat over the rendered contents of `fd`, which is kept from the GPU
+    // until it's released
+    cv::Mat lease(int fd, int rows, int cols, int type);
+    int outstanding() const;
+
+    // Starts handing returned buffers to `onReturn`. `start` is called with
+    // the buffers still out, before any of them can be returned, so whatever
+    // it sets up can leave them out until they are.
+    void attach(std::function<void(int)> onReturn,
+                const std::function<void(const std::vector<int> &)> &start);
+    // Stops handing back returned buffers
+    void detach();
+
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data,
+                           size_t *step, cv::AccessFlag flags,
+                           cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData *data, cv::AccessFlag accessflags,
+                  cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData *data) const override;
+
+  private:
+    OutputLeases(const std::vector<int> &fds, size_t size);
+
+    int index(int fd) const;
+
+    // Storage for the UMatData header of each buffer, like MatPool's
+    struct Header {
+        alignas(cv::UMatData) unsigned char storage[sizeof(cv::UMatData)];
+    };
+
+    std::vector<int> m_fds;
+    // Our own duplicates of m_fds, for syncing, closed when we are destroyed
+    std::vector<int> m_ownFds;
+    std::vector<uint8_t *> m_mappings;
+    size_t m_size;
+    mutable std::vector<Header> m_headers;
+
+    mutable std::mutex m_mutex;
+    mutable std::vector<bool> m_leased;
+    mutable int m_outstanding = 0;
+    std::function<void(int)> m_onReturn;
+    mutable std::shared_ptr<const OutputLeases> m_keepAlive;
+};
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <time.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Nanoseconds on CLOCK_BOOTTIME, the clock libcamera's SensorTimestamp uses
+inline int64_t bootTimeNs() {
+    timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+// Histogram of latencies in microseconds that any number of threads can
+// record into without locking. Buckets are exact below 8us, then 8 per power
+// of two, so a reported percentile is at most 12.5% above the real one.
+class LatencyHistogram {
+  public:
+    struct Snapshot {
+        uint64_t count;
+        uint64_t p50;
+        uint64_t p90;
+        uint64_t p99;
+        uint64_t max;
+    };
+
+    void record(int64_t us) {
+        uint64_t value = us > 0 ? static_cast<uint64_t>(us) : 0;
+        m_buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+
+        uint64_t max = m_max.load(std::memory_order_relaxed);
+        while (value > max && !m_max.compare_exchange_weak(
+                                  max, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    Snapshot snapshot() const {
+        std::array<uint64_t, BUCKETS> counts;
+        uint64_t total = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+
+        uint64_t max = m_max.load(std::memory_order_relaxed);
+        auto percentile = [&](uint64_t numerator) -> uint64_t {
+            // The rank of the sample we want, rounded up
+            uint64_t rank = (total * numerator + 99) / 100;
+            uint64_t seen = 0;
+            for (int i = 0; i < BUCKETS; i++) {
+                seen += counts[i];
+                if (seen >= rank && seen > 0) {
+                    uint64_t bound = bucketUpperBound(i);
+                    return bound < max ? bound : max;
+                }
+            }
+            return 0;
+        };
+
+        return {total, percentile(50), percentile(90), percentile(99), max};
+    }
+
+    void reset() {
+        for (auto &bucket : m_buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        m_max.store(0, std::memory_order_relaxed);
+    }
+
+  private:
+    static constexpr int SUB_BITS = 3;
+    // Anything over 2^32us (~70 minutes) lands in the last bucket
+    static constexpr int MAX_EXPONENT = 32;
+    static constexpr int BUCKETS = (MAX_EXPONENT - SUB_BITS + 1) << SUB_BITS;
+
+    static int bucketOf(uint64_t value) {
+        if (value < (1u << SUB_BITS)) {
+            return static_cast<int>(value);
+        }
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - SUB_BITS;
+        int bucket = ((shift + 1) << SUB_BITS) |
+                     static_cast<int>((value >> shift) & ((1 << SUB_BITS) - 1));
+        return bucket < BUCKETS ? bucket : BUCKETS - 1;
+    }
+
+    static uint64_t bucketUpperBound(int bucket) {
+        if (bucket < (1 << SUB_BITS)) {
+            return bucket;
+        }
+        int shift = (bucket >> SUB_BITS) - 1;
+        uint64_t mantissa = (bucket & ((1 << SUB_BITS) - 1)) | (1 << SUB_BITS);
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    std::array<std::atomic<uint64_t>, BUCKETS> m_buckets{};
+    std::atomic<uint64_t> m_max{0};
+};
+
+// The hops a frame takes on its way through CameraRunner
+enum class PipelineStage : int {
+    Capture = 0, // sensor timestamp -> libcamera's requestComplete
+    CameraQueue, // requestComplete -> threshold thread picks it up
+    GpuSubmit,   // building and submitting the GL commands
+    GpuRender,   // submitted -> display thread sees the render fence signal
+    Copy,        // copying out of the output buffer
+    Publish,     // handing the frame to `outgoing`
+    Total,       // sensor timestamp -> frame available to Java
+    NUM_STAGES
+};
+
+struct PipelineStats {
+    std::array<LatencyHistogram, static_cast<int>(PipelineStage::NUM_STAGES)>
+        stages;
+
+    std::atomic<uint64_t> framesPublished{0};
+    // The sensor produced frames we never saw, because no request was queued
+    std::atomic<uint64_t> sensorDrops{0};
+    // Every output buffer was still in use, so the frame never hit the GPU
+    std::atomic<uint64_t> gpuDrops{0};
+    // A frame was replaced in `outgoing` before anyone took it
+    std::atomic<uint64_t> unconsumedDrops{0};
+    // A newer camera frame was already waiting, so this one was skipped
+    std::atomic<uint64_t> staleDrops{0};
+    // The display thread had fallen behind, with its queue full, so a frame
+    // that was already rendered or copied was thrown away
+    std::atomic<uint64_t> displayDrops{0};
+
+    void record(PipelineStage stage, int64_t beginNs, int64_t endNs) {
+        stages[static_cast<int>(stage)].record((endNs - beginNs) / 1000);
+    }
+
+    void reset() {
+        for (auto &stage : stages) {
+            stage.reset();
+        }
+        framesPublished = 0;
+        sensorDrops = 0;
+        gpuDrops = 0;
+        unconsumedDrops = 0;
+        staleDrops = 0;
+        displayDrops = 0;
+    }
+
+    // Flattened as [count, p50, p90, p99, max] (microseconds) for each stage
+    // in PipelineStage order, followed by framesPublished, sensorDrops,
+    // gpuDrops, unconsumedDrops, staleDrops and displayDrops
+    std::vector<int64_t> flatten() const {
+        std::vector<int64_t> out;
+        for (const auto &stage : stages) {
+            auto snap = stage.snapshot();
+            out.insert(out.end(), {static_cast<int64_t>(snap.count),
+                                   static_cast<int64_t>(snap.p50),
+                                   static_cast<int64_t>(snap.p90),
+                                   static_cast<int64_t>(snap.p99),
+                                   static_cast<int64_t>(snap.max)});
+        }
+        out.insert(out.end(), {static_cast<int64_t>(framesPublished.load()),
+                               static_cast<int64_t>(sensorDrops.load()),
+                               static_cast<int64_t>(gpuDrops.load()),
+                               static_cast<int64_t>(unconsumedDrops.load()),
+                               static_cast<int64_t>(staleDrops.load()),
+                               static_cast<int64_t>(displayDrops.load())});
+        return out;
+    }
+};
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <GLES2/gl2.h>
+
+// Saves linked programs to disk with GL_OES_get_program_binary, so later runs
+// can load them instead of compiling from source. Entries are keyed by the
+// GL vendor, renderer and version along with the sources, so a driver update
+// or shader change is just a miss. Anything that doesn't load cleanly is
+// thrown away and compiled again.
+class ProgramCache {
+  public:
+    // An empty directory disables the cache
+    explicit ProgramCache(std::string directory);
+
+    // $PHOTON_SHADER_CACHE if set, otherwise a directory under
+    // $XDG_CACHE_HOME or ~/.cache
+    static std::string defaultDirectory();
+
+    // Both need a current GL context. load returns 0 on a miss.
+    GLuint load(const std::string &vertexSource,
+                const std::string &fragmentSource);
+    void store(GLuint program, const std::string &vertexSource,
+               const std::string &fragmentSource);
+
+  private:
+    // Checks for driver support. Needs a current context, so it's done on
+    // first use rather than in the constructor.
+    bool enabled();
+    uint64_t key(const std::string &vertexSource,
+                 const std::string &fragmentSource) const;
+    std::string path(uint64_t key) const;
+
+    std::string m_directory;
+    std::string m_driver;
+    bool m_checked = false;
+    bool m_supported = false;
+};
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture_file.h"
+#include "frame_source.h"
+
+// Plays back a capture file (see capture_file.h), so the pipeline can be run
+// on identical input without a camera attached. Camera settings are accepted
+// but ignored, as the frames have already been captured.
+class ReplayFrameSource : public FrameSource {
+  public:
+    /**
+     * @param path Capture file to play
+     * @param fps Frames per second to deliver at, or 0 to deliver each frame
+     * as soon as a buffer is free
+     * @param loop Whether to start over at the end of the file, rather than
+     * stopping
+     * @param bufferCount How many dma-bufs to cycle frames through
+     */
+    ReplayFrameSource(const std::string &path, double fps, bool loop = true,
+                      int bufferCount = 4);
+    ~ReplayFrameSource() override;
+
+    int width() const override;
+    int height() const override;
+    const std::vector<YuvBuffer> &buffers() const override;
+    libcamera::ColorSpace colorSpace() const override;
+    CameraModel model() const override;
+
+    bool startAndQueue() override;
+    void stop() override;
+    void requeue(const Frame &frame) override;
+
+  private:
+    void run();
+    void play();
+
+    CaptureFileReader m_reader;
+    double m_fps;
+    bool m_loop;
+
+    std::vector<YuvBuffer> m_buffers;
+    std::vector<uint8_t *> m_mapped;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::queue<int> m_free;
+    bool m_running = false;
+    std::thread m_thread;
+};
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <libcamera/camera.h>
+
+#include <memory>
+#include <vector>
+
+// One readout mode of a camera's sensor. Binned modes read out fewer pixels,
+// and so often run much faster than full resolution ones.
+struct SensorMode {
+    unsigned int width;
+    unsigned int height;
+    unsigned int bitDepth;
+    // Fastest frame rate the mode supports
+    double maxFps;
+    // Region of the pixel array the mode covers, in full resolution pixels
+    int cropX;
+    int cropY;
+    unsigned int cropWidth;
+    unsigned int cropHeight;
+};
+
+// Lists the modes a camera's sensor can run in, by configuring the camera
+// with each one in turn. The camera must not be in use, so call this before
+// creating a runner for it. Compressed and unrecognised raw formats are
+// skipped. Throws std::runtime_error if the camera can't be acquired, e.g.
+// because a runner already has it.
+std::vector<SensorMode>
+enumerateSensorModes(const std::shared_ptr<libcamera::Camera> &camera);
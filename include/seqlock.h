@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+
+// Publishes a small struct from any number of writer threads to readers that
+// must never block. Readers retry if a write lands while they're copying, so
+// they always see one whole published value, never a mix of two. Writers
+// are serialized with a mutex.
+template <typename T> class SeqLock {
+    static_assert(std::is_trivially_copyable_v<T>);
+
+  public:
+    explicit SeqLock(const T &value = {}) { write(value); }
+
+    SeqLock(const SeqLock &) = delete;
+    SeqLock &operator=(const SeqLock &) = delete;
+
+    // Returns the latest published value. If `version` isn't null, it's set
+    // to a number that changes every time a new value is published.
+    T load(uint32_t *version = nullptr) const {
+        while (true) {
+            uint32_t before = m_seq.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue; // a write is in progress
+            }
+
+            std::array<uint64_t, WORDS> words;
+            for (size_t i = 0; i < WORDS; i++) {
+                words[i] = m_words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (m_seq.load(std::memory_order_relaxed) == before) {
+                if (version) {
+                    *version = before;
+                }
+                T value;
+                std::memcpy(static_cast<void *>(&value), words.data(),
+                            sizeof(T));
+                return value;
+            }
+        }
+    }
+
+    // Cheap check for whether anything has been published since load()
+    // returned `version`
+    uint32_t version() const { return m_seq.load(std::memory_order_acquire); }
+
+    void store(const T &value) {
+        std::lock_guard lock{m_writeMutex};
+        write(value);
+    }
+
+    // Applies `modify` to the current value and publishes the result, as one
+    // atomic update with respect to other writers
+    template <typename F> void update(F &&modify) {
+        std::lock_guard lock{m_writeMutex};
+        T value = load();
+        modify(value);
+        write(value);
+    }
+
+  private:
+    static constexpr size_t WORDS = (sizeof(T) + 7) / 8;
+
+    void write(const T &value) {
+        std::array<uint64_t, WORDS> words{};
+        std::memcpy(words.data(), &value, sizeof(T));
+
+        uint32_t seq = m_seq.load(std::memory_order_relaxed);
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; i++) {
+            m_words[i].store(words[i], std::memory_order_relaxed);
+        }
+        m_seq.store(seq + 2, std::memory_order_release);
+    }
+
+    std::array<std::atomic<uint64_t>, WORDS> m_words{};
+    std::atomic<uint32_t> m_seq{0};
+    std::mutex m_writeMutex;
+};
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// A bounded ring buffer for exactly one producer thread and one consumer
+// thread. All storage is allocated up front, and there are no locks: push
+// never blocks (it fails if the ring is full), and pop only sleeps, on an
+// atomic wait, while the ring is empty.
+template <typename T> class SpscQueue {
+  public:
+    // Capacity is rounded up to the next power of two
+    explicit SpscQueue(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        m_slots.resize(size);
+        m_mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    // Producer only. Returns false if the queue is full.
+    bool push(T item) {
+        uint32_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) > m_mask) {
+            return false;
+        }
+
+        m_slots[head & m_mask] = std::move(item);
+        m_head.store(head + 1, std::memory_order_seq_cst);
+        // Only pay for the wake syscall if the consumer is actually asleep
+        if (m_sleeping.load(std::memory_order_seq_cst)) {
+            m_head.notify_one();
+        }
+        return true;
+    }
+
+    // Consumer only. Blocks until an item is available.
+    T pop() {
+        uint32_t tail = m_tail.load(std::memory_order_relaxed);
+        uint32_t head = m_head.load(std::memory_order_acquire);
+        for (int i = 0; head == tail && i < SPIN_COUNT; i++) {
+            head = m_head.load(std::memory_order_acquire);
+        }
+        while (head == tail) {
+            // Pairs with the seq_cst store/load in push(): either the
+            // producer sees that we're asleep, or we see its new head
+            m_sleeping.store(true, std::memory_order_seq_cst);
+            head = m_head.load(std::memory_order_seq_cst);
+            if (head == tail) {
+                m_head.wait(head, std::memory_order_acquire);
+                head = m_head.load(std::memory_order_acquire);
+            }
+            m_sleeping.store(false, std::memory_order_relaxed);
+        }
+        return take(tail);
+    }
+
+    // Consumer only.
+    std::optional<T> try_pop() {
+        uint32_t tail = m_tail.load(std::memory_order_relaxed);
+        if (m_head.load(std::memory_order_acquire) == tail) {
+            return std::nullopt;
+        }
+        return take(tail);
+    }
+
+    size_t capacity() const { return m_slots.size(); }
+
+  private:
+    // How many times pop() polls before going to sleep
+    static constexpr int SPIN_COUNT = 64;
+
+    T take(uint32_t tail) {
+        T item = std::move(m_slots[tail & m_mask]);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return item;
+    }
+
+    std::vector<T> m_slots;
+    size_t m_mask;
+
+    // Keep the producer's and consumer's indices on separate cache lines
+    alignas(64) std::atomic<uint32_t> m_head{0};
+    alignas(64) std::atomic<uint32_t> m_tail{0};
+    // Only ever written by the consumer
+    std::atomic<bool> m_sleeping{false};
+};
@@ -32,9 +32,6 @@
 #include "headless_opengl.h"
 #include "libcamera_jni.hpp"
 
-#define GLERROR() glerror(__LINE__)
-#define EGLERROR() eglerror(__LINE__)
-
 void test_res(int width, int height) {
     std::vector<std::shared_ptr<libcamera::Camera>> cameras = GetAllCameraIDs();
 
@@ -59,9 +56,11 @@ void test_res(int width, int height) {
         r->setCopyOptions(true, true);
         r->requestShaderIdx(static_cast<int>(ProcessType::Gray));
 
-        r->cameraGrabber().cameraSettings().exposureTimeUs = 100000;
-        r->cameraGrabber().cameraSettings().analogGain = 4;
-        r->cameraGrabber().cameraSettings().brightness = 0.0;
+        r->frameSource().updateSettings([](CameraSettings &settings) {
+            settings.exposureTimeUs = 100000;
+            settings.analogGain = 4;
+            settings.brightness = 0.0;
+        });
 
         std::printf("Started %s!\n", c->id().c_str());
     }
@@ -20,13 +20,61 @@
 #include <libcamera/control_ids.h>
 #include <libcamera/property_ids.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdio>
 #include <iostream>
 #include <stdexcept>
 #include <utility>
 
+static YuvBuffer yuvBuffer(const libcamera::FrameBuffer &buffer,
+                           unsigned int stride) {
+    const auto &planes = buffer.planes();
+    return {{
+        {planes[0].fd.get(), planes[0].offset, planes[0].length, stride},
+        {planes[1].fd.get(), planes[1].offset, planes[1].length, stride / 2},
+        {planes[2].fd.get(), planes[2].offset, planes[2].length, stride / 2},
+    }};
+}
+
+static CropRect toCropRect(const libcamera::Rectangle &rect) {
+    return {rect.x, rect.y, static_cast<int32_t>(rect.width),
+            static_cast<int32_t>(rect.height)};
+}
+
+// Fits a region of interest inside `bounds`. With keepAspect, it's first
+// grown around its centre to the aspect ratio of `output`.
+static libcamera::Rectangle fitCrop(const CropRect &roi,
+                                    const libcamera::Rectangle &bounds,
+                                    const libcamera::Size &output,
+                                    bool keepAspect) {
+    int64_t width = roi.width;
+    int64_t height = roi.height;
+    if (keepAspect && output.width > 0 && output.height > 0) {
+        if (width * output.height > height * output.width) {
+            height = width * output.height / output.width;
+        } else {
+            width = height * output.width / output.height;
+        }
+    }
+    width = std::clamp<int64_t>(width, 1, bounds.width);
+    height = std::clamp<int64_t>(height, 1, bounds.height);
+
+    int64_t x = roi.x + roi.width / 2 - width / 2;
+    int64_t y = roi.y + roi.height / 2 - height / 2;
+    x = std::clamp<int64_t>(x, bounds.x, bounds.x + bounds.width - width);
+    y = std::clamp<int64_t>(y, bounds.y, bounds.y + bounds.height - height);
+
+    return {static_cast<int>(x), static_cast<int>(y),
+            static_cast<unsigned int>(width),
+            static_cast<unsigned int>(height)};
+}
+
 CameraGrabber::CameraGrabber(std::shared_ptr<libcamera::Camera> camera,
-                             int width, int height, int rotation)
+                             int width, int height, int rotation,
+                             unsigned int bufferCount,
+                             const std::optional<SensorMode> &sensorMode,
+                             const std::optional<libcamera::Size> &processSize)
     : m_buf_allocator(camera), m_camera(std::move(camera)),
       m_cameraExposureProfiles(std::nullopt) {
 
@@ -45,8 +93,17 @@ CameraGrabber::CameraGrabber(std::shared_ptr<libcamera::Camera> camera,
 
     std::cout << "Model " << m_model << std::endl;
 
-    auto config = m_camera->generateConfiguration(
-        {libcamera::StreamRole::VideoRecording});
+    // With a processing size, the ISP also scales each frame down into a
+    // second, Viewfinder stream. Both streams are filled by the same request.
+    std::vector<libcamera::StreamRole> roles{
+        libcamera::StreamRole::VideoRecording};
+    if (processSize) {
+        roles.push_back(libcamera::StreamRole::Viewfinder);
+    }
+    auto config = m_camera->generateConfiguration(roles);
+    if (!config || config->size() != roles.size()) {
+        throw std::runtime_error("camera doesn't support the needed streams");
+    }
 
     // print active arrays
     if (m_camera->properties().contains(
@@ -65,6 +122,25 @@ CameraGrabber::CameraGrabber(std::shared_ptr<libcamera::Camera> camera,
 
     config->at(0).size.width = width;
     config->at(0).size.height = height;
+    if (processSize) {
+        config->at(1).size = *processSize;
+        config->at(1).pixelFormat = libcamera::formats::YUV420;
+        m_processIndex = 1;
+    }
+    if (bufferCount > 0) {
+        for (auto &streamConfig : *config) {
+            streamConfig.bufferCount = bufferCount;
+        }
+    }
+
+    if (sensorMode) {
+        libcamera::SensorConfiguration sensorConfig;
+        sensorConfig.bitDepth = sensorMode->bitDepth;
+        sensorConfig.outputSize = {sensorMode->width, sensorMode->height};
+        config->sensorConfig = sensorConfig;
+        std::printf("Requesting sensor mode %ux%u %u-bit\n", sensorMode->width,
+                    sensorMode->height, sensorMode->bitDepth);
+    }
 
     std::printf("Rotation = %i\n", rotation);
     if (rotation == 180) {
@@ -81,24 +157,40 @@ CameraGrabber::CameraGrabber(std::shared_ptr<libcamera::Camera> camera,
         throw std::runtime_error("failed to configure stream");
     }
 
-    std::cout << "Selected configuration: " << config->at(0).toString()
-              << std::endl;
+    for (const auto &streamConfig : *config) {
+        std::cout << "Selected configuration: " << streamConfig.toString()
+                  << " with " << streamConfig.bufferCount << " buffers"
+                  << std::endl;
+    }
 
-    auto stream = config->at(0).stream();
-    if (m_buf_allocator.allocate(stream) < 0) {
-        throw std::runtime_error("failed to allocate buffers");
+    // Each request carries one buffer from every stream, so we can only make
+    // as many requests as the stream with the fewest buffers allows
+    size_t requestCount = SIZE_MAX;
+    for (const auto &streamConfig : *config) {
+        if (m_buf_allocator.allocate(streamConfig.stream()) < 0) {
+            throw std::runtime_error("failed to allocate buffers");
+        }
+        requestCount = std::min(
+            requestCount,
+            m_buf_allocator.buffers(streamConfig.stream()).size());
     }
     m_config = std::move(config);
 
-    for (const auto &buffer : m_buf_allocator.buffers(stream)) {
-        auto request = m_camera->createRequest();
+    for (size_t i = 0; i < requestCount; i++) {
+        // The cookie maps completed requests back to their index in
+        // m_requests and m_buffers
+        auto request = m_camera->createRequest(m_requests.size());
+
+        for (size_t s = 0; s < m_config->size(); s++) {
+            const auto &streamConfig = m_config->at(s);
+            const auto &buffer =
+                m_buf_allocator.buffers(streamConfig.stream()).at(i);
+            request->addBuffer(streamConfig.stream(), buffer.get());
 
-        // auto &controls = request->controls();
-        // controls.set(libcamera::controls::FrameDurationLimits,
-        // {static_cast<int64_t>(8333), static_cast<int64_t>(8333)});
-        // controls.set(libcamera::controls::ExposureTime, 10000);
+            auto &buffers = s == m_processIndex ? m_buffers : m_fullResBuffers;
+            buffers.push_back(yuvBuffer(*buffer, streamConfig.stride));
+        }
 
-        request->addBuffer(stream, buffer.get());
         m_requests.push_back(std::move(request));
     }
 
@@ -116,17 +208,45 @@ void CameraGrabber::requestComplete(libcamera::Request *request) {
         return;
     }
 
-    static int i = 0;
-
-    i++;
-
-    if (m_onData) {
-        m_onData->operator()(request);
+    if (!m_onData) {
+        return;
     }
+
+    auto buffer =
+        request->buffers().at(m_config->at(m_processIndex).stream());
+    const auto &metadata = request->metadata();
+
+    /*
+    From libcamera docs:
+
+    The timestamp, expressed in nanoseconds, represents a
+    monotonically increasing counter since the system boot time, as
+    defined by the Linux-specific CLOCK_BOOTTIME clock id.
+    */
+    Frame frame{
+        .bufferIndex = static_cast<int>(request->cookie()),
+        .metadata = {
+            .sensorTimestamp = static_cast<uint64_t>(
+                metadata.get(libcamera::controls::SensorTimestamp)
+                    .value_or(0)),
+            // https://libcamera.org/api-html/namespacelibcamera_1_1controls.html#a4e1ca45653b62cd969d4d67a741076eb
+            .exposureTimeUs = static_cast<int32_t>(
+                metadata.get(libcamera::controls::ExposureTime).value_or(0)),
+            .analogGain =
+                metadata.get(libcamera::controls::AnalogueGain).value_or(0),
+            .sequence = buffer->metadata().sequence,
+            .scalerCrop = toCropRect(
+                metadata.get(libcamera::controls::ScalerCrop).value_or(
+                    libcamera::Rectangle{})),
+        }};
+
+    m_onData->operator()(frame);
 }
 
-void CameraGrabber::requeueRequest(libcamera::Request *request) {
+void CameraGrabber::requeue(const Frame &frame) {
     if (running) {
+        libcamera::Request *request = m_requests.at(frame.bufferIndex).get();
+
         // This resets all our controls
         // https://github.com/kbingham/libcamera/blob/master/src/libcamera/request.cpp#L397
         request->reuse(libcamera::Request::ReuseFlag::ReuseBuffers);
@@ -139,71 +259,164 @@ void CameraGrabber::requeueRequest(libcamera::Request *request) {
     }
 }
 
+std::optional<std::pair<int64_t, int64_t>>
+CameraGrabber::frameDurationLimits() const {
+    // Only meaningful once configured, as it depends on the sensor mode
+    const auto &controls = m_camera->controls();
+    auto it = controls.find(libcamera::controls::FrameDurationLimits.id());
+    if (it == controls.end()) {
+        return std::nullopt;
+    }
+    return std::make_pair(it->second.min().get<int64_t>(),
+                          it->second.max().get<int64_t>());
+}
+
+std::optional<CropRect> CameraGrabber::scalerCropMaximum() const {
+    const auto &controls = m_camera->controls();
+    auto it = controls.find(libcamera::controls::ScalerCrop.id());
+    if (it == controls.end()) {
+        return std::nullopt;
+    }
+    return toCropRect(it->second.max().get<libcamera::Rectangle>());
+}
+
 void CameraGrabber::setControls(libcamera::Request *request) {
     using namespace libcamera;
 
+    // libcamera keeps applying a control until a later request changes it,
+    // so each request only needs whatever changed since the last request we
+    // queued. Requests are queued and completed in order, so this stays
+    // right with several in flight.
+    if (m_queuedSettings && m_settings.version() == m_queuedVersion) {
+        return;
+    }
+    uint32_t version;
+    const CameraSettings settings = m_settings.load(&version);
+    const CameraSettings *last =
+        m_queuedSettings ? &m_queuedSettings.value() : nullptr;
+    if (last && *last == settings) {
+        m_queuedVersion = version;
+        return;
+    }
+
+    auto changed = [&](auto member) {
+        return !last || last->*member != settings.*member;
+    };
+
     auto &controls_ = request->controls();
-    if (m_model != OV9281) {
-        controls_.set(controls::AwbEnable, false); // AWB disabled
+
+    // These never change, so only go out with the first request
+    if (!last) {
+        if (m_model != OV9281) {
+            controls_.set(controls::AwbEnable, false); // AWB disabled
+        }
+
+        controls_.set(controls::ExposureValue, 0);
+
+        if (m_model != OV7251 && m_model != OV9281) {
+            controls_.set(controls::Sharpness, 1);
+        }
+    }
+
+    if (changed(&CameraSettings::minFrameDurationUs) ||
+        changed(&CameraSettings::maxFrameDurationUs)) {
+        // 1/fps=seconds
+        // seconds * 1e6 = uS
+        int64_t minDuration = settings.minFrameDurationUs;
+        int64_t maxDuration = settings.maxFrameDurationUs;
+        if (auto limits = frameDurationLimits()) {
+            auto [lowest, highest] = *limits;
+            minDuration = std::clamp(minDuration, lowest, highest);
+            maxDuration = std::clamp(maxDuration, minDuration, highest);
+        }
+        controls_.set(libcamera::controls::FrameDurationLimits,
+                      libcamera::Span<const int64_t, 2>{
+                          {minDuration, maxDuration}});
     }
-    controls_.set(controls::AnalogueGain,
-                  m_settings.analogGain); // Analog gain, min 1 max big number?
 
-    if (m_model != OV9281) {
+    if (changed(&CameraSettings::roi) ||
+        changed(&CameraSettings::roiKeepAspect)) {
+        if (auto maximum = scalerCropMaximum()) {
+            libcamera::Rectangle bounds{maximum->x, maximum->y,
+                                        static_cast<unsigned>(maximum->width),
+                                        static_cast<unsigned>(maximum->height)};
+            // Every stream is scaled from the same crop, so match the
+            // aspect ratio of the full size one
+            libcamera::Rectangle crop =
+                settings.roi.width > 0 && settings.roi.height > 0
+                    ? fitCrop(settings.roi, bounds, m_config->at(0).size,
+                              settings.roiKeepAspect)
+                    : bounds;
+            controls_.set(controls::ScalerCrop, crop);
+        }
+    }
+
+    if (changed(&CameraSettings::analogGain)) {
+        controls_.set(
+            controls::AnalogueGain,
+            settings.analogGain); // Analog gain, min 1 max big number?
+    }
+
+    if (m_model != OV9281 && (changed(&CameraSettings::awbRedGain) ||
+                              changed(&CameraSettings::awbBlueGain))) {
         controls_.set(controls::ColourGains,
                       libcamera::Span<const float, 2>{
-                          {m_settings.awbRedGain,
-                           m_settings.awbBlueGain}}); // AWB gains, red and
-                                                      // blue, unknown range
+                          {settings.awbRedGain,
+                           settings.awbBlueGain}}); // AWB gains, red and
+                                                    // blue, unknown range
     }
 
     // Note about brightness: -1 makes everything look deep fried, 0 is probably
     // best for most things
-    controls_.set(libcamera::controls::Brightness,
-                  m_settings.brightness); // -1 to 1, 0 means unchanged
-    controls_.set(controls::Contrast,
-                  m_settings.contrast); // Nominal 1
+    if (changed(&CameraSettings::brightness)) {
+        controls_.set(libcamera::controls::Brightness,
+                      settings.brightness); // -1 to 1, 0 means unchanged
+    }
+    if (changed(&CameraSettings::contrast)) {
+        controls_.set(controls::Contrast,
+                      settings.contrast); // Nominal 1
+    }
 
-    if (m_model != OV9281) {
+    if (m_model != OV9281 && changed(&CameraSettings::saturation)) {
         controls_.set(controls::Saturation,
-                      m_settings.saturation); // Nominal 1, 0 would be greyscale
+                      settings.saturation); // Nominal 1, 0 would be greyscale
     }
 
-    if (m_settings.doAutoExposure) {
-        controls_.set(controls::AeEnable,
-                      true); // Auto exposure disabled
-
-        controls_.set(controls::AeMeteringMode,
-                      controls::MeteringCentreWeighted);
-        if (m_model == OV9281) {
-            controls_.set(controls::AeExposureMode, controls::ExposureNormal);
-        } else {
-            controls_.set(controls::AeExposureMode, controls::ExposureShort);
+    if (settings.doAutoExposure) {
+        if (changed(&CameraSettings::doAutoExposure)) {
+            controls_.set(controls::AeEnable,
+                          true); // Auto exposure enabled
+
+            controls_.set(controls::AeMeteringMode,
+                          controls::MeteringCentreWeighted);
+            if (m_model == OV9281) {
+                controls_.set(controls::AeExposureMode,
+                              controls::ExposureNormal);
+            } else {
+                controls_.set(controls::AeExposureMode,
+                              controls::ExposureShort);
+            }
         }
     } else {
-        controls_.set(controls::AeEnable,
-                      false); // Auto exposure disabled
-        controls_.set(controls::ExposureTime,
-                      m_settings.exposureTimeUs); // in microseconds
+        if (changed(&CameraSettings::doAutoExposure)) {
+            controls_.set(controls::AeEnable,
+                          false); // Auto exposure disabled
+        }
+        if (changed(&CameraSettings::doAutoExposure) ||
+            changed(&CameraSettings::exposureTimeUs)) {
+            controls_.set(controls::ExposureTime,
+                          settings.exposureTimeUs); // in microseconds
+        }
     }
 
-    // 1/fps=seconds
-    // seconds * 1e6 = uS
-    constexpr const int MIN_FRAME_TIME = 1e6 / 120;
-    constexpr const int MAX_FRAME_TIME = 1e6 / 1;
-    controls_.set(
-        libcamera::controls::FrameDurationLimits,
-        libcamera::Span<const int64_t, 2>{{MIN_FRAME_TIME, MAX_FRAME_TIME}});
-
-    controls_.set(controls::ExposureValue, 0);
-
-    if (m_model != OV7251 && m_model != OV9281) {
-        controls_.set(controls::Sharpness, 1);
-    }
+    m_queuedSettings = settings;
+    m_queuedVersion = version;
 }
 
 bool CameraGrabber::startAndQueue() {
     running = true;
+    // The camera may have been reset, so send everything again
+    m_queuedSettings.reset();
     if (m_camera->start()) {
         return false; // failed to start camera
     }
@@ -223,13 +436,35 @@ void CameraGrabber::stop() {
     m_camera->stop();
 }
 
-void CameraGrabber::setOnData(
-    std::function<void(libcamera::Request *)> onData) {
-    m_onData = std::move(onData);
+const libcamera::StreamConfiguration &
+CameraGrabber::streamConfiguration() const {
+    return m_config->at(m_processIndex);
+}
+
+int CameraGrabber::width() const {
+    return m_config->at(m_processIndex).size.width;
 }
 
-void CameraGrabber::resetOnData() { m_onData.reset(); }
+int CameraGrabber::height() const {
+    return m_config->at(m_processIndex).size.height;
+}
+
+const std::vector<YuvBuffer> &CameraGrabber::buffers() const {
+    return m_buffers;
+}
+
+const std::vector<YuvBuffer> &CameraGrabber::fullResBuffers() const {
+    return m_fullResBuffers;
+}
+
+int CameraGrabber::fullResWidth() const {
+    return m_fullResBuffers.empty() ? 0 : m_config->at(0).size.width;
+}
+
+int CameraGrabber::fullResHeight() const {
+    return m_fullResBuffers.empty() ? 0 : m_config->at(0).size.height;
+}
 
-const libcamera::StreamConfiguration &CameraGrabber::streamConfiguration() {
-    return m_config->at(0);
+libcamera::ColorSpace CameraGrabber::colorSpace() const {
+    return m_config->at(m_processIndex).colorSpace.value();
 }
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "camera_group.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <utility>
+
+// A camera that keeps delivering frames while another has stalled would
+// otherwise pile them up here forever
+static constexpr size_t MAX_PENDING = 4;
+
+// Handed to a collector through its runner's `outgoing` to stop it
+static constexpr int64_t STOP_TIMESTAMP = -1;
+
+std::vector<int64_t> CameraGroupStats::flatten() const {
+    auto snap = skew.snapshot();
+    return {static_cast<int64_t>(snap.count),
+            static_cast<int64_t>(snap.p50),
+            static_cast<int64_t>(snap.p90),
+            static_cast<int64_t>(snap.p99),
+            static_cast<int64_t>(snap.max),
+            static_cast<int64_t>(setsPublished.load()),
+            static_cast<int64_t>(unmatchedFrames.load()),
+            static_cast<int64_t>(unconsumedSets.load())};
+}
+
+CameraGroup::CameraGroup(std::vector<CameraRunner *> runners,
+                         int64_t toleranceNs)
+    : m_runners(std::move(runners)), m_toleranceNs(toleranceNs),
+      m_pending(m_runners.size()) {
+    if (m_runners.empty()) {
+        throw std::runtime_error("camera group has no cameras");
+    }
+    if (toleranceNs < 0) {
+        throw std::runtime_error("negative camera group tolerance");
+    }
+    // Two collectors taking from one `outgoing` would never form a set
+    for (size_t i = 0; i < m_runners.size(); i++) {
+        if (std::find(m_runners.begin() + i + 1, m_runners.end(),
+                      m_runners[i]) != m_runners.end()) {
+            throw std::runtime_error("camera group has a camera twice");
+        }
+    }
+}
+
+CameraGroup::~CameraGroup() {
+    if (m_running) {
+        stop();
+    }
+}
+
+bool CameraGroup::start() {
+    m_stats.reset();
+    for (auto &pending : m_pending) {
+        pending.clear();
+    }
+
+    m_running = true;
+    for (size_t i = 0; i < m_runners.size(); i++) {
+        m_collectors.emplace_back([this, i] { collect(i); });
+    }
+
+    // Back to back, so the cameras' first frames land as close together as
+    // we can get them without a hardware trigger
+    bool ok = true;
+    for (auto runner : m_runners) {
+        ok &= runner->start();
+    }
+    return ok;
+}
+
+void CameraGroup::stop() {
+    // Otherwise the stop sentinels would sit in `outgoing` and end the next
+    // start's collectors straight away
+    if (!m_running) {
+        return;
+    }
+
+    for (auto runner : m_runners) {
+        runner->stop();
+    }
+
+    // The runners are stopped, so nothing else sets their `outgoing` now
+    for (auto runner : m_runners) {
+        MatPair stop;
+        stop.captureTimestamp = STOP_TIMESTAMP;
+        runner->outgoing.set(std::move(stop));
+    }
+    for (auto &collector : m_collectors) {
+        collector.join();
+    }
+    m_collectors.clear();
+    m_running = false;
+}
+
+void CameraGroup::collect(size_t i) {
+    while (true) {
+        MatPair pair = m_runners[i]->outgoing.take();
+        if (pair.captureTimestamp == STOP_TIMESTAMP) {
+            break;
+        }
+        // Can't be matched without knowing when it was captured
+        if (pair.captureTimestamp == 0) {
+            m_stats.unmatchedFrames++;
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock{m_mutex};
+        auto &pending = m_pending[i];
+        if (pending.size() >= MAX_PENDING) {
+            pending.pop_front();
+            m_stats.unmatchedFrames++;
+        }
+        pending.push_back(std::move(pair));
+        match();
+    }
+}
+
+void CameraGroup::match() {
+    while (std::none_of(m_pending.begin(), m_pending.end(),
+                        [](const auto &pending) { return pending.empty(); })) {
+        size_t oldest = 0;
+        int64_t oldestNs = m_pending[0].front().captureTimestamp;
+        int64_t newestNs = oldestNs;
+        for (size_t i = 1; i < m_pending.size(); i++) {
+            int64_t ns = m_pending[i].front().captureTimestamp;
+            if (ns < oldestNs) {
+                oldest = i;
+                oldestNs = ns;
+            }
+            newestNs = std::max(newestNs, ns);
+        }
+
+        // The oldest frame is too old to pair with what the others have
+        // now, and their later frames will only be newer
+        if (newestNs - oldestNs > m_toleranceNs) {
+            m_pending[oldest].pop_front();
+            m_stats.unmatchedFrames++;
+            continue;
+        }
+
+        FrameSet set;
+        set.skewNs = newestNs - oldestNs;
+        for (auto &pending : m_pending) {
+            set.frames.push_back(std::move(pending.front()));
+            pending.pop_front();
+        }
+
+        m_stats.skew.record(set.skewNs / 1000);
+        m_stats.setsPublished++;
+        if (outgoing.set(std::move(set))) {
+            m_stats.unconsumedSets++;
+        }
+    }
+}
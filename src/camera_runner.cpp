@@ -17,11 +17,12 @@
 
 #include "camera_runner.h"
 
-#include <chrono>
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <unordered_map>
 #include <utility>
 
@@ -33,39 +34,177 @@ using latch = std::latch;
 using latch = Latch;
 #endif
 
-#include <libcamera/control_ids.h>
-#include <libcamera/property_ids.h>
 #include <linux/dma-buf.h>
-#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
-using steady_clock = std::chrono::steady_clock;
-using namespace std::literals::chrono_literals;
+#include "deinterleave.h"
 
-static double approxRollingAverage(double avg, double new_sample) {
-    avg -= avg / 50;
-    avg += new_sample / 50;
+// How many frames' worth of Mats we keep preallocated. This covers the frame
+// being filled, the one waiting in `outgoing` and a couple held by Java;
+// anything beyond that falls back to the heap.
+static constexpr int MAT_POOL_SIZE = 4;
 
-    return avg;
+// Past this, more buffering only adds latency and eats CMA
+static constexpr int MAX_BUFFER_COUNT = 16;
+
+static std::array<GlHsvThresholder::DmaBufPlaneData, 3>
+yuvPlaneData(const YuvBuffer &buffer) {
+    std::array<GlHsvThresholder::DmaBufPlaneData, 3> ret;
+    for (size_t i = 0; i < buffer.size(); i++) {
+        ret[i] = {buffer[i].fd, static_cast<EGLint>(buffer[i].offset),
+                  static_cast<EGLint>(buffer[i].stride)};
+    }
+    return ret;
+}
+
+// (dma_buf fd, (mapping, length))
+using DmaBufMappings = std::unordered_map<int, std::pair<uint8_t *, size_t>>;
+
+// Maps every dma-buf used by `buffers` once, covering all their planes
+static DmaBufMappings mapBuffers(const std::vector<YuvBuffer> &buffers) {
+    DmaBufMappings mappings;
+    for (const auto &buffer : buffers) {
+        for (const auto &plane : buffer) {
+            auto &length = mappings[plane.fd].second;
+            length = std::max<size_t>(length, plane.offset + plane.length);
+        }
+    }
+    for (auto &[fd, mapping] : mappings) {
+        void *ptr =
+            mmap(nullptr, mapping.second, PROT_READ, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) {
+            throw std::runtime_error("failed to mmap camera buffer");
+        }
+        mapping.first = static_cast<uint8_t *>(ptr);
+    }
+    return mappings;
+}
+
+// Copies one plane to `dst`, without the row padding. Returns the end of
+// what was written.
+static uint8_t *copyPlane(const FramePlane &plane,
+                          const DmaBufMappings &mappings, int width,
+                          int height, uint8_t *dst) {
+    const uint8_t *src = mappings.at(plane.fd).first + plane.offset;
+
+    syncDmaBuf(plane.fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+    for (int row = 0; row < height; row++) {
+        std::memcpy(dst, src + row * plane.stride, width);
+        dst += width;
+    }
+    syncDmaBuf(plane.fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+    return dst;
+}
+
+// Copies a frame into `out` as I420
+static void copyI420(const YuvBuffer &buffer, const DmaBufMappings &mappings,
+                     int width, int height, cv::Mat &out) {
+    uint8_t *dst = out.data;
+    for (size_t i = 0; i < buffer.size(); i++) {
+        int planeWidth = i == 0 ? width : width / 2;
+        int planeHeight = i == 0 ? height : height / 2;
+        dst = copyPlane(buffer[i], mappings, planeWidth, planeHeight, dst);
+    }
+}
+
+// Bytes of MatPair::color per frame, or 0 if the format has none
+static size_t colorSize(OutputFormat format, bool mono, int width,
+                        int height) {
+    size_t pixels = static_cast<size_t>(width) * height;
+    switch (format) {
+    case OutputFormat::ColorAndProcessed:
+        return mono ? pixels : pixels * 3;
+    case OutputFormat::Gray:
+        return pixels;
+    case OutputFormat::Bgr:
+        return pixels * 3;
+    case OutputFormat::Bgra:
+        return pixels * 4;
+    case OutputFormat::Yuv420:
+        return pixels * 3 / 2;
+    default:
+        return 0;
+    }
+}
+
+void RunnerOptions::validate() const {
+    if (cameraBufferCount > MAX_BUFFER_COUNT) {
+        throw std::runtime_error("too many camera buffers");
+    }
+    if (outputBufferCount < 1 || outputBufferCount > MAX_BUFFER_COUNT) {
+        throw std::runtime_error("output buffer count out of range");
+    }
+    if (static_cast<int32_t>(outputFormat) < 0 ||
+        outputFormat >= OutputFormat::NUM_OUTPUT_FORMATS) {
+        throw std::runtime_error("unknown output format");
+    }
+}
+
+static const RunnerOptions &validated(const RunnerOptions &options) {
+    options.validate();
+    return options;
 }
 
 CameraRunner::CameraRunner(int width, int height, int rotation,
-                           std::shared_ptr<libcamera::Camera> cam)
-    : m_camera(std::move(cam)), m_width(width), m_height(height),
-      grabber(m_camera, m_width, m_height, rotation),
-      m_thresholder(m_width, m_height, grabber.model()),
-      allocer("/dev/dma_heap/linux,cma") {
-
-    grabber.setOnData(
-        [&](libcamera::Request *request) { camera_queue.push(request); });
-
-    fds = {allocer.alloc_buf_fd(m_width * m_height * 4),
-           allocer.alloc_buf_fd(m_width * m_height * 4),
-           allocer.alloc_buf_fd(m_width * m_height * 4)};
+                           std::shared_ptr<libcamera::Camera> cam,
+                           const RunnerOptions &options)
+    : CameraRunner(std::make_unique<CameraGrabber>(
+                       std::move(cam), width, height, rotation,
+                       validated(options).cameraBufferCount,
+                       options.sensorMode, options.processSize),
+                   options) {}
+
+CameraRunner::CameraRunner(std::unique_ptr<FrameSource> source,
+                           const RunnerOptions &options)
+    : m_options(validated(options)), m_source(std::move(source)),
+      m_width(m_source->width()),
+      m_height(m_source->height()),
+      // Both queues have room for every buffer that can be in flight, plus
+      // the sentinel pushed by stop()
+      camera_queue(m_source->buffers().size() + 1),
+      gpu_queue(m_options.outputBufferCount + 1),
+      m_thresholder(m_width, m_height, m_source->model(),
+                    m_options.outputFormat),
+      allocer(makeAnyDmaBufAllocator()) {
+
+    // Can't fail, since every buffer in flight fits in the queue
+    m_source->setOnData([&](const Frame &frame) {
+        camera_queue.push({frame, bootTimeNs()});
+    });
+
+    const OutputFormat format = m_options.outputFormat;
+    if (usesGpu(format)) {
+        const size_t outputSize =
+            m_width * m_height * m_thresholder.outputChannels();
+        for (int i = 0; i < m_options.outputBufferCount; i++) {
+            fds.push_back(allocer(outputSize));
+        }
+        m_leases = OutputLeases::make(fds, outputSize);
+    }
+
+    size_t colorBytes =
+        colorSize(format, m_thresholder.mono(), m_width, m_height);
+    if (colorBytes) {
+        m_colorPool = MatPool::make(colorBytes, MAT_POOL_SIZE);
+    }
+    if (format == OutputFormat::ColorAndProcessed ||
+        format == OutputFormat::ProcessedOnly) {
+        m_processedPool = MatPool::make(m_width * m_height, MAT_POOL_SIZE);
+    }
+    if (!m_source->fullResBuffers().empty()) {
+        m_fullResPool = MatPool::make(m_source->fullResWidth() *
+                                          m_source->fullResHeight() * 3 / 2,
+                                      MAT_POOL_SIZE);
+    }
 }
 
 CameraRunner::~CameraRunner() {
+    // Leases still out keep their own fds to the buffers, and the buffers
+    // mapped, but have no one to go back to
+    if (m_leases) {
+        m_leases->detach();
+    }
     for (auto i : fds) {
         close(i);
     }
@@ -78,173 +217,317 @@ void CameraRunner::setCopyOptions(bool copyIn, bool copyOut) {
     m_copyOutput = copyOut;
 }
 
-bool CameraRunner::start() {
-    unsigned int stride = grabber.streamConfiguration().stride;
+void CameraRunner::setCopyFullRes(bool copyFullRes) {
+    m_copyFullRes = copyFullRes;
+}
+
+bool CameraRunner::setZeroCopy(bool zeroCopy, LeaseExhaustion exhaustion) {
+    // BGR plus a separate processed Mat can't be viewed in a BGRA buffer, and
+    // handing out BGRA instead would change the Mats' types with whether a
+    // lease happened to be free
+    const OutputFormat format = m_options.outputFormat;
+    if (zeroCopy && usesGpu(format) && m_thresholder.outputChannels() != 1 &&
+        format != OutputFormat::Bgra) {
+        return false;
+    }
+    m_leaseExhaustion = exhaustion;
+    m_zeroCopy = zeroCopy;
+    return true;
+}
 
+int CameraRunner::leasesOutstanding() const {
+    return m_leases ? m_leases->outstanding() : 0;
+}
+
+bool CameraRunner::shouldLease() const {
+    if (!m_zeroCopy) {
+        return false;
+    }
+    // Leasing this one must leave another for the GPU
+    return m_leaseExhaustion == LeaseExhaustion::DropFrames ||
+           m_leases->outstanding() + 1 < static_cast<int>(fds.size());
+}
+
+void CameraRunner::requeue(const Frame &frame) {
+    std::lock_guard<std::mutex> lock{camera_stop_mutex};
+    m_source->requeue(frame);
+}
+
+bool CameraRunner::start() {
     latch start_frame_grabber{2};
 
-    threshold = std::thread([&, stride]() {
-        m_thresholder.start(fds);
-        auto colorspace = grabber.streamConfiguration().colorSpace.value();
+    m_stats.reset();
+
+    threshold = std::thread([&]() {
+        auto colorspace = m_source->colorSpace();
 
-        double gpuTimeAvgMs = 0;
+        const OutputFormat format = m_options.outputFormat;
+        const bool gpu = usesGpu(format);
+
+        std::vector<std::array<GlHsvThresholder::DmaBufPlaneData, 3>> inputs;
+        for (const auto &buffer : m_source->buffers()) {
+            inputs.push_back(yuvPlaneData(buffer));
+        }
+        if (gpu) {
+            // Frames leased before the last stop may still be out
+            m_leases->attach(
+                [this](int fd) { m_thresholder.returnBuffer(fd); },
+                [&](const std::vector<int> &leased) {
+                    m_thresholder.start(fds, inputs,
+                                        encodingFromColorspace(colorspace),
+                                        rangeFromColorspace(colorspace),
+                                        leased);
+                });
+        }
+
+        std::optional<unsigned int> lastSequence;
+
+        const int fullResWidth = m_source->fullResWidth();
+        const int fullResHeight = m_source->fullResHeight();
+        DmaBufMappings fullResMappings =
+            mapBuffers(m_source->fullResBuffers());
+        // Color that's copied straight from the camera rather than round
+        // tripping through the GPU: a mono sensor's Y plane, or the frame
+        // itself in the formats that don't render anything
+        const bool colorFromCamera =
+            !gpu || (m_thresholder.mono() &&
+                     format == OutputFormat::ColorAndProcessed);
+        DmaBufMappings inputMappings = colorFromCamera
+                                           ? mapBuffers(m_source->buffers())
+                                           : DmaBufMappings{};
+
+        auto copyColor = [&](const Frame &frame) {
+            const auto &buffer = m_source->buffers().at(frame.bufferIndex);
+            cv::Mat color;
+            if (format == OutputFormat::Yuv420) {
+                color = m_colorPool->mat(m_height * 3 / 2, m_width, CV_8UC1);
+                copyI420(buffer, inputMappings, m_width, m_height, color);
+            } else {
+                color = m_colorPool->mat(m_height, m_width, CV_8UC1);
+                copyPlane(buffer[0], inputMappings, m_width, m_height,
+                          color.data);
+            }
+            return color;
+        };
+
+        auto recordFrame = [&](const Frame &frame) {
+            std::lock_guard<std::mutex> lock{m_recorder_mutex};
+            if (m_recorder) {
+                m_recorder->record(m_source->buffers().at(frame.bufferIndex),
+                                   frame.metadata);
+            }
+        };
+        // Records the frame if we're recording, and hands it back to the
+        // source to be filled again
+        auto finishFrame = [&](const Frame &frame) {
+            recordFrame(frame);
+            requeue(frame);
+        };
 
         start_frame_grabber.count_down();
         while (true) {
-            // std::printf("Threshold thread!\n");
-            auto request = camera_queue.pop();
+            auto [frame, completedNs] = camera_queue.pop();
+
+            // Only the newest waiting frame matters; give the rest back
+            while (m_options.dropStaleFrames && frame.bufferIndex >= 0) {
+                auto newer = camera_queue.try_pop();
+                if (!newer) {
+                    break;
+                }
+                finishFrame(frame);
+                m_stats.staleDrops++;
+                frame = newer->frame;
+                completedNs = newer->completedNs;
+            }
 
-            if (!request) {
+            if (frame.bufferIndex < 0) {
                 break;
             }
 
-            auto planes = request->buffers()
-                              .at(grabber.streamConfiguration().stream())
-                              ->planes();
+            auto yuv_data =
+                yuvPlaneData(m_source->buffers().at(frame.bufferIndex));
 
-            std::array<GlHsvThresholder::DmaBufPlaneData, 3> yuv_data{{
-                {planes[0].fd.get(), static_cast<EGLint>(planes[0].offset),
-                 static_cast<EGLint>(stride)},
-                {planes[1].fd.get(), static_cast<EGLint>(planes[1].offset),
-                 static_cast<EGLint>(stride / 2)},
-                {planes[2].fd.get(), static_cast<EGLint>(planes[2].offset),
-                 static_cast<EGLint>(stride / 2)},
-            }};
+            unsigned int sequence = frame.metadata.sequence;
+            if (lastSequence && sequence > *lastSequence + 1) {
+                m_stats.sensorDrops += sequence - *lastSequence - 1;
+            }
+            lastSequence = sequence;
 
-            auto begintime = steady_clock::now();
+            uint64_t sensorTimestamp = frame.metadata.sensorTimestamp;
+            if (sensorTimestamp) {
+                m_stats.record(PipelineStage::Capture, sensorTimestamp,
+                               completedNs);
+            }
+
+            int64_t gpuBeginNs = bootTimeNs();
+            m_stats.record(PipelineStage::CameraQueue, completedNs,
+                           gpuBeginNs);
 
             auto type = static_cast<ProcessType>(m_shaderIdx.load());
 
-            int out = m_thresholder.testFrame(
+            // Formats that don't render anything just need the frame copied.
+            // For a mono sensor, the Y plane is also the result of None and
+            // Gray, so those don't need the GPU either.
+            if (!gpu || (colorFromCamera && (type == ProcessType::None ||
+                                             type == ProcessType::Gray))) {
+                cv::Mat color = copyColor(frame);
+                int64_t copiedNs = bootTimeNs();
+                m_stats.record(PipelineStage::Copy, gpuBeginNs, copiedNs);
+
+                // Unlike rendered frames, these aren't limited by the output
+                // buffers, so the display thread can fall behind
+                if (!gpu_queue.push({{0, EGL_NO_SYNC_KHR, -1},
+                                     gpu ? type : ProcessType::None,
+                                     sensorTimestamp,
+                                     frame.metadata.exposureTimeUs, copiedNs,
+                                     frame.metadata.scalerCrop,
+                                     std::move(color), {}})) {
+                    m_stats.displayDrops++;
+                }
+                finishFrame(frame);
+                continue;
+            }
+
+            auto out = m_thresholder.testFrame(
                 yuv_data, encodingFromColorspace(colorspace),
                 rangeFromColorspace(colorspace), type);
 
-            if (out != 0) {
-                /*
-                From libcamera docs:
-
-                The timestamp, expressed in nanoseconds, represents a
-                monotonically increasing counter since the system boot time, as
-                defined by the Linux-specific CLOCK_BOOTTIME clock id.
-                */
-                uint64_t sensorTimestamp = static_cast<uint64_t>(
-                    request->metadata()
-                        .get(libcamera::controls::SensorTimestamp)
-                        .value_or(0));
-
-                // https://libcamera.org/api-html/namespacelibcamera_1_1controls.html#a4e1ca45653b62cd969d4d67a741076eb
-                int32_t exposureTimeUs = static_cast<int32_t>(
-                    request->metadata()
-                        .get(libcamera::controls::ExposureTime)
-                        .value_or(0));
-
-                gpu_queue.push({out, type, sensorTimestamp, exposureTimeUs});
-            }
+            if (out.fd != 0) {
+                int64_t gpuSubmittedNs = bootTimeNs();
+                m_stats.record(PipelineStage::GpuSubmit, gpuBeginNs,
+                               gpuSubmittedNs);
 
-            std::chrono::duration<double, std::milli> elapsedMillis =
-                steady_clock::now() - begintime;
-            if (elapsedMillis > 0.9ms) {
-                gpuTimeAvgMs =
-                    approxRollingAverage(gpuTimeAvgMs, elapsedMillis.count());
-                // std::cout << "GLProcess: " << elapsedMillis.count() <<
-                // std::endl;
-            }
+                // Copied while the GPU works, and before the camera can
+                // reuse the buffer
+                cv::Mat color;
+                if (colorFromCamera && m_copyInput) {
+                    color = copyColor(frame);
+                }
 
-            {
-                std::lock_guard<std::mutex> lock{camera_stop_mutex};
-                grabber.requeueRequest(request);
+                cv::Mat fullRes;
+                if (m_fullResPool && m_copyFullRes) {
+                    fullRes = m_fullResPool->mat(fullResHeight * 3 / 2,
+                                                 fullResWidth, CV_8UC1);
+                    copyI420(
+                        m_source->fullResBuffers().at(frame.bufferIndex),
+                        fullResMappings, fullResWidth, fullResHeight,
+                        fullRes);
+                }
+
+                recordFrame(frame);
+
+                // The display thread requeues the frame once the GPU is
+                // done with it, so the camera can't write over it mid-render
+                if (!gpu_queue.push({out, type, sensorTimestamp,
+                                     frame.metadata.exposureTimeUs,
+                                     gpuSubmittedNs, frame.metadata.scalerCrop,
+                                     std::move(color), std::move(fullRes),
+                                     frame})) {
+                    // Full of frames that skipped the GPU
+                    m_thresholder.waitForRender(out);
+                    m_thresholder.returnBuffer(out.fd);
+                    requeue(frame);
+                    m_stats.displayDrops++;
+                }
+            } else {
+                m_stats.gpuDrops++;
+                finishFrame(frame);
             }
         }
-        m_thresholder.release();
+        if (gpu) {
+            m_thresholder.release();
+        }
+
+        for (const auto &[fd, mapping] : fullResMappings) {
+            munmap(mapping.first, mapping.second);
+        }
+        for (const auto &[fd, mapping] : inputMappings) {
+            munmap(mapping.first, mapping.second);
+        }
     });
 
     display = std::thread([&]() {
-        std::unordered_map<int, unsigned char *> mmaped;
-
-        for (auto fd : fds) {
-            auto mmap_ptr = mmap(nullptr, m_width * m_height * 4, PROT_READ,
-                                 MAP_SHARED, fd, 0);
-            if (mmap_ptr == MAP_FAILED) {
-                throw std::runtime_error("failed to mmap pointer");
+        auto publish = [&](MatPair &&mat_pair, uint64_t captureTimestamp) {
+            int64_t publishBeginNs = bootTimeNs();
+            if (outgoing.set(std::move(mat_pair))) {
+                m_stats.unconsumedDrops++;
             }
-            mmaped.emplace(fd, static_cast<unsigned char *>(mmap_ptr));
-        }
 
-        // double copyTimeAvgMs = 0;
-        double fpsTimeAvgMs = 0;
+            int64_t publishedNs = bootTimeNs();
+            m_stats.record(PipelineStage::Publish, publishBeginNs,
+                           publishedNs);
+            if (captureTimestamp) {
+                m_stats.record(PipelineStage::Total, captureTimestamp,
+                               publishedNs);
+            }
+            m_stats.framesPublished++;
+        };
 
         start_frame_grabber.count_down();
-        auto lastTime = steady_clock::now();
         while (true) {
-            // std::printf("Display thread!\n");
             auto data = gpu_queue.pop();
-            if (data.fd == -1) {
+            if (data.frame.fd == -1) {
                 break;
             }
 
-            auto mat_pair = MatPair(m_width, m_height);
+            MatPair mat_pair;
 
             // Save the current shader idx
             mat_pair.frameProcessingType = static_cast<int32_t>(data.type);
             mat_pair.captureTimestamp = data.captureTimestamp;
             mat_pair.exposureTimeUs = data.exposureTimeUs;
-
-            uint8_t *processed_out_buf = mat_pair.processed.data;
-            uint8_t *color_out_buf = mat_pair.color.data;
-
-            // auto begin_time = steady_clock::now();
-
-            auto input_ptr = mmaped.at(data.fd);
-            int bound = m_width * m_height;
-
-            {
-                struct dma_buf_sync dma_sync{};
-                dma_sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW;
-                int ret = ::ioctl(data.fd, DMA_BUF_IOCTL_SYNC, &dma_sync);
-                if (ret)
-                    throw std::runtime_error("failed to start DMA buf sync");
-            }
-
-            if (m_copyInput) {
-                for (int i = 0; i < bound; i++) {
-                    std::memcpy(color_out_buf + i * 3, input_ptr + i * 4, 3);
+            mat_pair.fullRes = std::move(data.fullRes);
+            mat_pair.scalerCrop =
+                cv::Rect(data.scalerCrop.x, data.scalerCrop.y,
+                         data.scalerCrop.width, data.scalerCrop.height);
+
+            mat_pair.color = std::move(data.color);
+
+            // Already copied by the threshold thread, without the GPU
+            if (data.frame.fd == 0) {
+                // A mono sensor's None or Gray, where the Y plane is the
+                // processed result too
+                if (usesGpu(m_options.outputFormat)) {
+                    mat_pair.processed = mat_pair.color;
                 }
+                publish(std::move(mat_pair), data.captureTimestamp);
+                continue;
             }
 
-            if (m_copyOutput) {
-                for (int i = 0; i < bound; i++) {
-                    processed_out_buf[i] = input_ptr[i * 4 + 3];
+            auto input_ptr = m_leases->data(data.frame.fd);
+
+            m_thresholder.waitForRender(data.frame);
+            requeue(data.input);
+            int64_t copyBeginNs = bootTimeNs();
+            m_stats.record(PipelineStage::GpuRender, data.gpuSubmittedNs,
+                           copyBeginNs);
+
+            if (shouldLease()) {
+                // The same types copyRendered gives, as setZeroCopy only
+                // leases the formats where they match
+                if (m_thresholder.outputChannels() == 1) {
+                    mat_pair.processed = m_leases->lease(
+                        data.frame.fd, m_height, m_width, CV_8UC1);
+                } else {
+                    mat_pair.color = m_leases->lease(data.frame.fd, m_height,
+                                                     m_width, CV_8UC4);
                 }
-            }
+                m_stats.record(PipelineStage::Copy, copyBeginNs,
+                               bootTimeNs());
 
-            {
-                struct dma_buf_sync dma_sync{};
-                dma_sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW;
-                int ret = ::ioctl(data.fd, DMA_BUF_IOCTL_SYNC, &dma_sync);
-                if (ret)
-                    throw std::runtime_error("failed to start DMA buf sync");
+                publish(std::move(mat_pair), data.captureTimestamp);
+                continue;
             }
 
-            m_thresholder.returnBuffer(data.fd);
-            outgoing.set(std::move(mat_pair));
-
-            // std::chrono::duration<double, std::milli> elapsedMillis =
-            //     steady_clock::now() - begin_time;
-            // copyTimeAvgMs =
-            //     approxRollingAverage(copyTimeAvgMs, elapsedMillis.count());
-            // std::cout << "Copy: " << copyTimeAvgMs << std::endl;
-
-            auto now = steady_clock::now();
-            std::chrono::duration<double, std::milli> elapsed =
-                (now - lastTime);
-            fpsTimeAvgMs = approxRollingAverage(fpsTimeAvgMs, elapsed.count());
-            // std::printf("Delta %.2f FPS: %.2f\n", fpsTimeAvgMs, 1000.0 /
-            // fpsTimeAvgMs);
-            lastTime = now;
-        }
+            syncDmaBuf(data.frame.fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW);
+            copyRendered(input_ptr, data.type, mat_pair);
+            syncDmaBuf(data.frame.fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW);
+
+            m_thresholder.returnBuffer(data.frame.fd);
+
+            m_stats.record(PipelineStage::Copy, copyBeginNs, bootTimeNs());
 
-        for (const auto &[fd, pointer] : mmaped) {
-            munmap(pointer, m_width * m_height * 4);
+            publish(std::move(mat_pair), data.captureTimestamp);
         }
     });
 
@@ -252,25 +535,115 @@ bool CameraRunner::start() {
 
     {
         std::lock_guard<std::mutex> lock{camera_stop_mutex};
-        return grabber.startAndQueue();
+        return m_source->startAndQueue();
     }
 }
 
+void CameraRunner::copyRendered(const uint8_t *rendered, ProcessType type,
+                                MatPair &pair) {
+    int pixels = m_width * m_height;
+    switch (m_options.outputFormat) {
+    case OutputFormat::ColorAndProcessed:
+        if (type == ProcessType::Multi && !m_thresholder.resultOnly()) {
+            if (!m_copyOutput) {
+                break;
+            }
+            if (!m_planesPool) {
+                m_planesPool = MatPool::make(pixels * 4, MAT_POOL_SIZE);
+            }
+            // One buffer, so all four go back to the pool together
+            cv::Mat planes = m_planesPool->mat(m_height * 4, m_width, CV_8UC1);
+            uint8_t *const pointers[4] = {
+                planes.data, planes.data + pixels, planes.data + pixels * 2,
+                planes.data + pixels * 3};
+            deinterleavePlanes(rendered, pointers, pixels);
+            for (int i = 0; i < 3; i++) {
+                pair.processedPlanes[i] =
+                    planes.rowRange(m_height * i, m_height * (i + 1));
+            }
+            pair.processed = planes.rowRange(m_height * 3, m_height * 4);
+            break;
+        }
+        pair.processed = m_processedPool->mat(m_height, m_width, CV_8UC1);
+        if (m_thresholder.resultOnly()) {
+            // Color was copied from the camera by the threshold thread
+            if (m_copyOutput) {
+                std::memcpy(pair.processed.data, rendered, pixels);
+            }
+        } else {
+            pair.color = m_colorPool->mat(m_height, m_width, CV_8UC3);
+            deinterleaveColorAlpha(
+                rendered, m_copyInput ? pair.color.data : nullptr,
+                m_copyOutput ? pair.processed.data : nullptr, pixels);
+        }
+        break;
+    case OutputFormat::ProcessedOnly:
+        pair.processed = m_processedPool->mat(m_height, m_width, CV_8UC1);
+        std::memcpy(pair.processed.data, rendered, pixels);
+        break;
+    case OutputFormat::Bgr:
+        pair.color = m_colorPool->mat(m_height, m_width, CV_8UC3);
+        deinterleaveColorAlpha(rendered, pair.color.data, nullptr, pixels);
+        break;
+    case OutputFormat::Bgra:
+        pair.color = m_colorPool->mat(m_height, m_width, CV_8UC4);
+        std::memcpy(pair.color.data, rendered, pixels * 4);
+        break;
+    default:
+        break;
+    }
+}
+
+void CameraRunner::startRecording(const std::string &path,
+                                  uint32_t maxFrames) {
+    stopRecording();
+
+    auto recorder = std::make_unique<CaptureRecorder>(
+        path, m_width, m_height, m_source->buffers().at(0)[0].stride,
+        m_source->model(), m_source->colorSpace(), maxFrames);
+
+    std::lock_guard<std::mutex> lock{m_recorder_mutex};
+    m_recorder = std::move(recorder);
+}
+
+int64_t CameraRunner::stopRecording() {
+    std::unique_ptr<CaptureRecorder> recorder;
+    {
+        std::lock_guard<std::mutex> lock{m_recorder_mutex};
+        recorder = std::move(m_recorder);
+    }
+    if (!recorder) {
+        return -1;
+    }
+    // Outside the lock, so the threshold thread never waits on the writer
+    return recorder->finish();
+}
+
 void CameraRunner::stop() {
     std::printf("stopping all\n");
     // stop the camera
     {
         std::lock_guard<std::mutex> lock{camera_stop_mutex};
-        grabber.stop();
+        m_source->stop();
     }
 
-    // push sentinel value to stop threshold thread
-    camera_queue.push(nullptr);
+    // push sentinel value to stop threshold thread. The camera is stopped, so
+    // the source's thread won't push again and we're the only producer now.
+    camera_queue.push({{-1, {}}, 0});
     threshold.join();
 
-    // push sentinel value to stop display thread
-    gpu_queue.push({-1, ProcessType::None, 0, 0});
+    // push sentinel value to stop display thread. Frames that skipped the GPU
+    // can fill the queue, but the display thread is still draining it.
+    while (!gpu_queue.push({{-1, EGL_NO_SYNC_KHR, -1}, ProcessType::None, 0,
+                            0, 0, {}, {}, {}})) {
+        std::this_thread::yield();
+    }
     display.join();
 
+    // Leases returned from here on are made renderable by the next start
+    if (m_leases) {
+        m_leases->detach();
+    }
+
     std::printf("stopped all\n");
 }
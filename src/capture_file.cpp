@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "capture_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <stdexcept>
+
+libcamera::ColorSpace captureColorSpace(const CaptureFileHeader &header) {
+    using libcamera::ColorSpace;
+    return ColorSpace{
+        static_cast<ColorSpace::Primaries>(header.primaries),
+        static_cast<ColorSpace::TransferFunction>(header.transferFunction),
+        static_cast<ColorSpace::YcbcrEncoding>(header.ycbcrEncoding),
+        static_cast<ColorSpace::Range>(header.range),
+    };
+}
+
+CaptureFileReader::CaptureFileReader(const std::string &path) {
+    m_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0) {
+        throw std::runtime_error("failed to open capture file " + path);
+    }
+
+    struct stat st;
+    if (fstat(m_fd, &st) < 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(CaptureFileHeader)) {
+        close(m_fd);
+        throw std::runtime_error("capture file too small");
+    }
+    m_size = st.st_size;
+
+    void *data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED) {
+        close(m_fd);
+        throw std::runtime_error("failed to mmap capture file");
+    }
+    m_data = static_cast<uint8_t *>(data);
+    m_header = reinterpret_cast<const CaptureFileHeader *>(m_data);
+    m_index = nullptr;
+
+    const auto &h = *m_header;
+    const char *error = nullptr;
+    if (std::memcmp(h.magic, CAPTURE_FILE_MAGIC, sizeof(h.magic)) != 0) {
+        error = "not a capture file";
+    } else if (h.version != CAPTURE_FILE_VERSION) {
+        error = "unsupported capture file version";
+    } else if (h.frameSize !=
+               static_cast<uint64_t>(h.stride) * h.height * 3 / 2) {
+        error = "capture file frame size doesn't match its format";
+    } else if (h.frameCount > h.frameCapacity ||
+               h.indexOffset +
+                       uint64_t{h.frameCapacity} * sizeof(CaptureFrameIndex) >
+                   m_size) {
+        error = "capture file index is truncated";
+    } else {
+        m_index = reinterpret_cast<const CaptureFrameIndex *>(
+            m_data + h.indexOffset);
+        for (uint32_t i = 0; i < h.frameCount; i++) {
+            if (m_index[i].offset < h.dataOffset ||
+                m_index[i].offset + h.frameSize > m_size) {
+                error = "capture file frame is out of bounds";
+                break;
+            }
+        }
+    }
+
+    if (error) {
+        munmap(m_data, m_size);
+        close(m_fd);
+        throw std::runtime_error(error);
+    }
+}
+
+CaptureFileReader::~CaptureFileReader() {
+    munmap(m_data, m_size);
+    close(m_fd);
+}
+
+const CaptureFrameIndex &CaptureFileReader::index(uint32_t frame) const {
+    if (frame >= m_header->frameCount) {
+        throw std::out_of_range("capture frame out of range");
+    }
+    return m_index[frame];
+}
+
+const uint8_t *CaptureFileReader::frame(uint32_t frame) const {
+    return m_data + index(frame).offset;
+}
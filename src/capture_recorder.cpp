@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "capture_recorder.h"
+
+#include <fcntl.h>
+#include <linux/dma-buf.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+
+#include "dma_buf_alloc.h"
+
+static uint64_t roundUpToPage(uint64_t size) {
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    return (size + page - 1) / page * page;
+}
+
+CaptureRecorder::CaptureRecorder(const std::string &path, int width,
+                                 int height, unsigned int stride,
+                                 CameraModel model,
+                                 const libcamera::ColorSpace &colorSpace,
+                                 uint32_t maxFrames, int ringSize)
+    : m_height(height), m_stride(stride),
+      m_frameSize(stride * height * 3 / 2),
+      m_frameStride(roundUpToPage(m_frameSize)), m_free(ringSize),
+      m_pending(ringSize + 1) {
+    uint64_t indexOffset = sizeof(CaptureFileHeader);
+    uint64_t dataOffset =
+        roundUpToPage(indexOffset + maxFrames * sizeof(CaptureFrameIndex));
+    m_fileSize = dataOffset + maxFrames * m_frameStride;
+
+    m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        throw std::runtime_error("failed to create capture file " + path);
+    }
+
+    // Actually reserve the blocks, so running out of space shows up here and
+    // not as a SIGBUS halfway through a match
+    if (posix_fallocate(m_fd, 0, m_fileSize) != 0) {
+        close(m_fd);
+        throw std::runtime_error("failed to preallocate capture file");
+    }
+
+    void *file =
+        mmap(nullptr, m_fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (file == MAP_FAILED) {
+        close(m_fd);
+        throw std::runtime_error("failed to mmap capture file");
+    }
+    m_file = static_cast<uint8_t *>(file);
+    m_header = reinterpret_cast<CaptureFileHeader *>(m_file);
+    m_index = reinterpret_cast<CaptureFrameIndex *>(m_file + indexOffset);
+
+    *m_header = {};
+    std::memcpy(m_header->magic, CAPTURE_FILE_MAGIC, sizeof(m_header->magic));
+    m_header->version = CAPTURE_FILE_VERSION;
+    m_header->width = width;
+    m_header->height = height;
+    m_header->stride = stride;
+    m_header->frameSize = m_frameSize;
+    m_header->model = model;
+    m_header->primaries = static_cast<uint8_t>(colorSpace.primaries);
+    m_header->transferFunction =
+        static_cast<uint8_t>(colorSpace.transferFunction);
+    m_header->ycbcrEncoding = static_cast<uint8_t>(colorSpace.ycbcrEncoding);
+    m_header->range = static_cast<uint8_t>(colorSpace.range);
+    m_header->frameCapacity = maxFrames;
+    m_header->frameCount = 0;
+    m_header->indexOffset = indexOffset;
+    m_header->dataOffset = dataOffset;
+
+    // Zeroing the ring faults it in now, rather than on the first frames
+    m_ring.resize(static_cast<size_t>(ringSize) * m_frameSize);
+    for (int i = 0; i < ringSize; i++) {
+        m_free.push(i);
+    }
+
+    m_writer = std::thread([this] { writer(); });
+}
+
+CaptureRecorder::~CaptureRecorder() {
+    if (m_writer.joinable()) {
+        finish();
+    }
+}
+
+uint32_t CaptureRecorder::finish() {
+    m_pending.push({-1, {}});
+    m_writer.join();
+
+    for (const auto &[fd, mapping] : m_sources) {
+        munmap(mapping.first, mapping.second);
+    }
+
+    uint32_t written = m_written;
+    uint64_t used = m_header->dataOffset + written * m_frameStride;
+    munmap(m_file, m_fileSize);
+    // Give back the space we preallocated but never used
+    if (ftruncate(m_fd, used)) {
+        std::printf("Failed to trim capture file\n");
+    }
+    close(m_fd);
+
+    std::printf("Recorded %u frames, dropped %u\n", written,
+                static_cast<uint32_t>(m_dropped));
+    return written;
+}
+
+const uint8_t *CaptureRecorder::mapSource(int fd, size_t length) {
+    auto it = m_sources.find(fd);
+    if (it != m_sources.end()) {
+        if (it->second.second >= length) {
+            return it->second.first;
+        }
+        munmap(it->second.first, it->second.second);
+        m_sources.erase(it);
+    }
+
+    void *ptr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        throw std::runtime_error("failed to mmap frame buffer");
+    }
+    m_sources.emplace(fd, std::make_pair(static_cast<uint8_t *>(ptr), length));
+    return static_cast<uint8_t *>(ptr);
+}
+
+bool CaptureRecorder::record(const YuvBuffer &buffer,
+                             const FrameMetadata &metadata) {
+    std::optional<int> slot;
+    if (m_queued < m_header->frameCapacity) {
+        slot = m_free.try_pop();
+    }
+    if (!slot) {
+        m_dropped++;
+        return false;
+    }
+
+    const size_t planeSizes[3] = {m_stride * m_height,
+                                  m_stride / 2 * (m_height / 2),
+                                  m_stride / 2 * (m_height / 2)};
+
+    uint8_t *out = m_ring.data() + static_cast<size_t>(*slot) * m_frameSize;
+    for (size_t i = 0; i < buffer.size(); i++) {
+        const auto &plane = buffer[i];
+        const uint8_t *in = mapSource(plane.fd, plane.offset + plane.length);
+
+        syncDmaBuf(plane.fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+        std::memcpy(out, in + plane.offset, planeSizes[i]);
+        syncDmaBuf(plane.fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+
+        out += planeSizes[i];
+    }
+
+    m_pending.push({*slot, metadata});
+    m_queued++;
+    return true;
+}
+
+void CaptureRecorder::writer() {
+    while (true) {
+        auto pending = m_pending.pop();
+        if (pending.slot < 0) {
+            break;
+        }
+
+        uint32_t i = m_written;
+        uint64_t offset = m_header->dataOffset + i * m_frameStride;
+        std::memcpy(m_file + offset,
+                    m_ring.data() +
+                        static_cast<size_t>(pending.slot) * m_frameSize,
+                    m_frameSize);
+        m_free.push(pending.slot);
+
+        m_index[i] = {
+            .offset = offset,
+            .sensorTimestamp = pending.metadata.sensorTimestamp,
+            .exposureTimeUs = pending.metadata.exposureTimeUs,
+            .analogGain = pending.metadata.analogGain,
+            .sequence = pending.metadata.sequence,
+            .reserved = 0,
+        };
+        // Only count the frame once its index entry is in place
+        m_header->frameCount = i + 1;
+        m_written = i + 1;
+    }
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "deinterleave.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DEINTERLEAVE_X86 1
+#endif
+
+template <bool Color, bool Alpha>
+static void scalarKernel(const uint8_t *in, uint8_t *color, uint8_t *alpha,
+                         size_t pixels) {
+    for (size_t i = 0; i < pixels; i++) {
+        if constexpr (Color) {
+            color[i * 3 + 0] = in[i * 4 + 0];
+            color[i * 3 + 1] = in[i * 4 + 1];
+            color[i * 3 + 2] = in[i * 4 + 2];
+        }
+        if constexpr (Alpha) {
+            alpha[i] = in[i * 4 + 3];
+        }
+    }
+}
+
+#if defined(__ARM_NEON)
+
+template <bool Color, bool Alpha>
+static void vectorKernel(const uint8_t *in, uint8_t *color, uint8_t *alpha,
+                         size_t pixels) {
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        uint8x16x4_t px = vld4q_u8(in + i * 4);
+        if constexpr (Color) {
+            uint8x16x3_t bgr = {{px.val[0], px.val[1], px.val[2]}};
+            vst3q_u8(color + i * 3, bgr);
+        }
+        if constexpr (Alpha) {
+            vst1q_u8(alpha + i, px.val[3]);
+        }
+    }
+    scalarKernel<Color, Alpha>(in + i * 4, Color ? color + i * 3 : nullptr,
+                               Alpha ? alpha + i : nullptr, pixels - i);
+}
+
+#elif defined(DEINTERLEAVE_X86)
+
+// Does 16 pixels (4 registers in, 3 color + 1 alpha registers out) at a time
+template <bool Color, bool Alpha>
+__attribute__((target("ssse3"))) static void
+vectorKernel(const uint8_t *in, uint8_t *color, uint8_t *alpha,
+             size_t pixels) {
+    // Pack the 3 color bytes of each pixel into the low 12 bytes, zero the rest
+    const __m128i color_mask =
+        _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    // Pack the alpha bytes into the low 4 bytes, zero the rest
+    const __m128i alpha_mask = _mm_setr_epi8(3, 7, 11, 15, -1, -1, -1, -1, -1,
+                                             -1, -1, -1, -1, -1, -1, -1);
+
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        const __m128i *src = reinterpret_cast<const __m128i *>(in + i * 4);
+        __m128i p0 = _mm_loadu_si128(src + 0);
+        __m128i p1 = _mm_loadu_si128(src + 1);
+        __m128i p2 = _mm_loadu_si128(src + 2);
+        __m128i p3 = _mm_loadu_si128(src + 3);
+
+        if constexpr (Color) {
+            __m128i c0 = _mm_shuffle_epi8(p0, color_mask);
+            __m128i c1 = _mm_shuffle_epi8(p1, color_mask);
+            __m128i c2 = _mm_shuffle_epi8(p2, color_mask);
+            __m128i c3 = _mm_shuffle_epi8(p3, color_mask);
+
+            __m128i *dst = reinterpret_cast<__m128i *>(color + i * 3);
+            _mm_storeu_si128(dst + 0, _mm_or_si128(c0, _mm_slli_si128(c1, 12)));
+            _mm_storeu_si128(dst + 1, _mm_or_si128(_mm_srli_si128(c1, 4),
+                                                   _mm_slli_si128(c2, 8)));
+            _mm_storeu_si128(dst + 2, _mm_or_si128(_mm_srli_si128(c2, 8),
+                                                   _mm_slli_si128(c3, 4)));
+        }
+        if constexpr (Alpha) {
+            __m128i a01 = _mm_unpacklo_epi32(_mm_shuffle_epi8(p0, alpha_mask),
+                                             _mm_shuffle_epi8(p1, alpha_mask));
+            __m128i a23 = _mm_unpacklo_epi32(_mm_shuffle_epi8(p2, alpha_mask),
+                                             _mm_shuffle_epi8(p3, alpha_mask));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(alpha + i),
+                             _mm_unpacklo_epi64(a01, a23));
+        }
+    }
+    scalarKernel<Color, Alpha>(in + i * 4, Color ? color + i * 3 : nullptr,
+                               Alpha ? alpha + i : nullptr, pixels - i);
+}
+
+#endif
+
+template <bool Color, bool Alpha>
+static void dispatch(const uint8_t *in, uint8_t *color, uint8_t *alpha,
+                     size_t pixels) {
+#if defined(__ARM_NEON)
+    vectorKernel<Color, Alpha>(in, color, alpha, pixels);
+#elif defined(DEINTERLEAVE_X86)
+    static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+    if (has_ssse3) {
+        vectorKernel<Color, Alpha>(in, color, alpha, pixels);
+    } else {
+        scalarKernel<Color, Alpha>(in, color, alpha, pixels);
+    }
+#else
+    scalarKernel<Color, Alpha>(in, color, alpha, pixels);
+#endif
+}
+
+void deinterleaveColorAlpha(const uint8_t *in, uint8_t *color, uint8_t *alpha,
+                            size_t pixels) {
+    if (color && alpha) {
+        dispatch<true, true>(in, color, alpha, pixels);
+    } else if (color) {
+        dispatch<true, false>(in, color, nullptr, pixels);
+    } else if (alpha) {
+        dispatch<false, true>(in, nullptr, alpha, pixels);
+    }
+}
+
+void deinterleaveColorAlphaScalar(const uint8_t *in, uint8_t *color,
+                                  uint8_t *alpha, size_t pixels) {
+    if (color && alpha) {
+        scalarKernel<true, true>(in, color, alpha, pixels);
+    } else if (color) {
+        scalarKernel<true, false>(in, color, nullptr, pixels);
+    } else if (alpha) {
+        scalarKernel<false, true>(in, nullptr, alpha, pixels);
+    }
+}
+
+void deinterleavePlanesScalar(const uint8_t *in, uint8_t *const planes[4],
+                              size_t pixels) {
+    for (int c = 0; c < 4; c++) {
+        if (!planes[c]) {
+            continue;
+        }
+        for (size_t i = 0; i < pixels; i++) {
+            planes[c][i] = in[i * 4 + c];
+        }
+    }
+}
+
+#if defined(__ARM_NEON)
+
+static void planesVectorKernel(const uint8_t *in, uint8_t *const planes[4],
+                               size_t pixels) {
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        uint8x16x4_t px = vld4q_u8(in + i * 4);
+        for (int c = 0; c < 4; c++) {
+            if (planes[c]) {
+                vst1q_u8(planes[c] + i, px.val[c]);
+            }
+        }
+    }
+    uint8_t *const rest[4] = {
+        planes[0] ? planes[0] + i : nullptr,
+        planes[1] ? planes[1] + i : nullptr,
+        planes[2] ? planes[2] + i : nullptr,
+        planes[3] ? planes[3] + i : nullptr,
+    };
+    deinterleavePlanesScalar(in + i * 4, rest, pixels - i);
+}
+
+#elif defined(DEINTERLEAVE_X86)
+
+// Does 16 pixels (4 registers in, 1 register per plane out) at a time, the
+// same way vectorKernel does alpha
+__attribute__((target("ssse3"))) static void
+planesVectorKernel(const uint8_t *in, uint8_t *const planes[4],
+                   size_t pixels) {
+    // Pack byte c of each pixel into the low 4 bytes, zero the rest
+    const __m128i masks[4] = {
+        _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                      -1),
+        _mm_setr_epi8(1, 5, 9, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                      -1),
+        _mm_setr_epi8(2, 6, 10, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                      -1, -1),
+        _mm_setr_epi8(3, 7, 11, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                      -1, -1),
+    };
+
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        const __m128i *src = reinterpret_cast<const __m128i *>(in + i * 4);
+        __m128i p0 = _mm_loadu_si128(src + 0);
+        __m128i p1 = _mm_loadu_si128(src + 1);
+        __m128i p2 = _mm_loadu_si128(src + 2);
+        __m128i p3 = _mm_loadu_si128(src + 3);
+
+        for (int c = 0; c < 4; c++) {
+            if (!planes[c]) {
+                continue;
+            }
+            __m128i v01 = _mm_unpacklo_epi32(_mm_shuffle_epi8(p0, masks[c]),
+                                             _mm_shuffle_epi8(p1, masks[c]));
+            __m128i v23 = _mm_unpacklo_epi32(_mm_shuffle_epi8(p2, masks[c]),
+                                             _mm_shuffle_epi8(p3, masks[c]));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(planes[c] + i),
+                             _mm_unpacklo_epi64(v01, v23));
+        }
+    }
+    uint8_t *const rest[4] = {
+        planes[0] ? planes[0] + i : nullptr,
+        planes[1] ? planes[1] + i : nullptr,
+        planes[2] ? planes[2] + i : nullptr,
+        planes[3] ? planes[3] + i : nullptr,
+    };
+    deinterleavePlanesScalar(in + i * 4, rest, pixels - i);
+}
+
+#endif
+
+void deinterleavePlanes(const uint8_t *in, uint8_t *const planes[4],
+                        size_t pixels) {
+#if defined(__ARM_NEON)
+    planesVectorKernel(in, planes, pixels);
+#elif defined(DEINTERLEAVE_X86)
+    static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+    if (has_ssse3) {
+        planesVectorKernel(in, planes, pixels);
+    } else {
+        deinterleavePlanesScalar(in, planes, pixels);
+    }
+#else
+    deinterleavePlanesScalar(in, planes, pixels);
+#endif
+}
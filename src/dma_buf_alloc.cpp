@@ -20,9 +20,13 @@
 #include <fcntl.h>
 #include <linux/dma-buf.h>
 #include <linux/dma-heap.h>
+#include <linux/udmabuf.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
+#include <cstdio>
+#include <memory>
 #include <stdexcept>
 #include <string>
 
@@ -47,3 +51,72 @@ int DmaBufAlloc::alloc_buf_fd(size_t len) {
     }
     return alloc.fd;
 }
+
+UdmabufAlloc::UdmabufAlloc() {
+    int udmabuf_fd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (udmabuf_fd < 0) {
+        throw std::runtime_error("failed to open udmabuf");
+    }
+    m_udmabuf_fd = udmabuf_fd;
+}
+
+UdmabufAlloc::~UdmabufAlloc() { close(m_udmabuf_fd); }
+
+int UdmabufAlloc::alloc_buf_fd(size_t len) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    len = (len + page - 1) / page * page;
+
+    // udmabuf requires the memfd to be sealed against shrinking, so the pages
+    // can't disappear out from under the dma-buf
+    int memfd = memfd_create("udmabuf", MFD_ALLOW_SEALING | MFD_CLOEXEC);
+    if (memfd < 0) {
+        throw std::runtime_error("failed to create memfd");
+    }
+    if (ftruncate(memfd, len) < 0 ||
+        fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK) < 0) {
+        close(memfd);
+        throw std::runtime_error("failed to size memfd");
+    }
+
+    struct udmabuf_create create = {};
+    create.memfd = memfd;
+    create.flags = UDMABUF_FLAGS_CLOEXEC;
+    create.offset = 0;
+    create.size = len;
+
+    // The dma-buf holds its own reference to the pages
+    int fd = ioctl(m_udmabuf_fd, UDMABUF_CREATE, &create);
+    close(memfd);
+    if (fd < 0) {
+        throw std::runtime_error("failed to allocate udmabuf");
+    }
+    return fd;
+}
+
+std::function<int(size_t)> makeAnyDmaBufAllocator() {
+    for (const char *heap :
+         {"/dev/dma_heap/linux,cma", "/dev/dma_heap/system"}) {
+        try {
+            auto alloc = std::make_shared<DmaBufAlloc>(heap);
+            std::printf("Allocating from %s\n", heap);
+            return [alloc](size_t len) { return alloc->alloc_buf_fd(len); };
+        } catch (const std::runtime_error &) {
+        }
+    }
+
+    auto alloc = std::make_shared<UdmabufAlloc>();
+    std::printf("Allocating from /dev/udmabuf\n");
+    return [alloc](size_t len) { return alloc->alloc_buf_fd(len); };
+}
+
+void syncDmaBuf(int fd, uint64_t flags) {
+    if (!trySyncDmaBuf(fd, flags)) {
+        throw std::runtime_error("failed to sync DMA buf");
+    }
+}
+
+bool trySyncDmaBuf(int fd, uint64_t flags) noexcept {
+    struct dma_buf_sync dma_sync{};
+    dma_sync.flags = flags;
+    return ::ioctl(fd, DMA_BUF_IOCTL_SYNC, &dma_sync) == 0;
+}
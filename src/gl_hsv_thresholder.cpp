@@ -18,7 +18,12 @@
 #include "gl_hsv_thresholder.h"
 
 #include <libdrm/drm_fourcc.h>
+#include <poll.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <cstdio>
 #include <stdexcept>
 #include <string>
@@ -31,90 +36,39 @@
 #include "gl_shader_source.h"
 #include "glerror.h"
 
-#define GLERROR() glerror(__LINE__)
-#define EGLERROR() eglerror(__LINE__)
-
-GLuint make_shader(GLenum type, const char *source) {
-    auto shader = glCreateShader(type);
-
-    // void *ctx = eglGetCurrentContext();
-    // std::printf("Shader idx: %i context ptr: %lu\n", (int) shader,
-    // (size_t)ctx);
-
-    if (!shader) {
-        throw std::runtime_error("failed to create shader");
-    }
-    glShaderSource(shader, 1, &source, nullptr);
-    GLERROR();
-    glCompileShader(shader);
-    GLERROR();
-
-    GLint status;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-    if (!status) {
-        GLint log_size;
-        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &log_size);
-
-        std::string out;
-        out.resize(log_size);
-        glGetShaderInfoLog(shader, log_size, nullptr, out.data());
-
-        glDeleteShader(shader);
-        std::printf("Shader:\n%s\n", source);
-        throw std::runtime_error("failed to compile shader with error: " + out);
-    }
-
-    return shader;
+// An input buffer's planes may all live in one dma_buf at different offsets,
+// so plane 0's fd and offset together identify the buffer
+static uint64_t inputKey(const GlHsvThresholder::DmaBufPlaneData &plane) {
+    return (static_cast<uint64_t>(plane.fd) << 32) |
+           static_cast<uint32_t>(plane.offset);
 }
 
-GLuint make_program(const char *vertex_source, const char *fragment_source) {
-    auto vertex_shader = make_shader(GL_VERTEX_SHADER, vertex_source);
-    auto fragment_shader = make_shader(GL_FRAGMENT_SHADER, fragment_source);
-
-    auto program = glCreateProgram();
-    glAttachShader(program, vertex_shader);
-    GLERROR();
-    glAttachShader(program, fragment_shader);
-    GLERROR();
-    glLinkProgram(program);
-    GLERROR();
-
-    GLint status;
-    glGetProgramiv(program, GL_LINK_STATUS, &status);
-    if (!status) {
-        GLint log_size;
-        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &log_size);
-
-        std::string out;
-        out.resize(log_size);
-        glGetProgramInfoLog(program, log_size, nullptr, out.data());
-
-        throw std::runtime_error("failed to link program with error: " + out);
-    }
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader);
+// Adds `defines` to a shader, after the #version line that has to come first
+static std::string withDefines(const char *source,
+                               const std::string &defines) {
+    std::string ret = source;
+    ret.insert(ret.find('\n') + 1, defines);
+    return ret;
+}
 
-    return program;
+bool usesGpu(OutputFormat format) {
+    return format != OutputFormat::Gray && format != OutputFormat::Yuv420;
 }
 
-GlHsvThresholder::GlHsvThresholder(int width, int height, CameraModel model)
-    : m_width(width), m_height(height),
-      useGrayScalePassThrough(isGrayScale(model)) {
+GlHsvThresholder::GlHsvThresholder(int width, int height, CameraModel model,
+                                   OutputFormat format)
+    : m_width(width), m_height(height), m_mono(isGrayScale(model)),
+      m_resultOnly(format == OutputFormat::ProcessedOnly ||
+                   (m_mono && format == OutputFormat::ColorAndProcessed)) {
 
-    m_status = createHeadless();
-    m_context = m_status.context;
-    m_display = m_status.display;
+    m_gpu = GpuContext::acquire();
+    m_display = m_gpu->display();
+    m_context = m_gpu->createContext();
 }
 
 GlHsvThresholder::~GlHsvThresholder() {
-    for (auto &program : m_programs)
-        glDeleteProgram(program);
-
-    glDeleteBuffers(1, &m_quad_vbo);
-    for (const auto &[key, value] : m_framebuffers) {
-        glDeleteFramebuffers(1, &value);
-    }
-    destroyHeadless(m_status);
+    // Everything not shared was deleted by release()
+    m_gpu->destroyContext(m_context);
 }
 
 // static void on_gl_error(EGLenum error,const char *command,EGLint
@@ -129,7 +83,10 @@ GlHsvThresholder::~GlHsvThresholder() {
 //     std::printf("Error111: %s\n", message);
 // }
 
-void GlHsvThresholder::start(const std::vector<int> &output_buf_fds) {
+void GlHsvThresholder::start(
+    const std::vector<int> &output_buf_fds,
+    const std::vector<std::array<DmaBufPlaneData, 3>> &input_bufs,
+    EGLint encoding, EGLint range, const std::vector<int> &busy) {
     static auto glEGLImageTargetTexture2DOES =
         (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)eglGetProcAddress(
             "glEGLImageTargetTexture2DOES");
@@ -143,6 +100,15 @@ void GlHsvThresholder::start(const std::vector<int> &output_buf_fds) {
     }
     EGLERROR();
 
+    {
+        std::string extensions = eglQueryString(m_display, EGL_EXTENSIONS);
+        m_hasNativeFence =
+            extensions.find("EGL_ANDROID_native_fence_sync") !=
+            std::string::npos;
+        m_hasFenceSync =
+            extensions.find("EGL_KHR_fence_sync") != std::string::npos;
+    }
+
     // static auto glDebugMessageCallbackKHR =
     //         (PFNEGLDEBUGMESSAGECONTROLKHRPROC)eglGetProcAddress("glDebugMessageCallbackKHR");
     // glEnable(GL_DEBUG_OUTPUT_KHR);
@@ -152,18 +118,47 @@ void GlHsvThresholder::start(const std::vector<int> &output_buf_fds) {
     // glDebugMessageCallbackKHR(on_gl_error, nullptr);
     // GLERROR();
 
-    m_programs.reserve(static_cast<int>(ProcessType::NUM_PROCESS_TYPES));
-    m_programs[0] = make_program(VERTEX_SOURCE, NONE_FRAGMENT_SOURCE);
-    m_programs[1] = make_program(VERTEX_SOURCE, HSV_FRAGMENT_SOURCE);
-    if (useGrayScalePassThrough) {
-        m_programs[2] = make_program(VERTEX_SOURCE, GRAY_FRAGMENT_SOURCE);
-    } else {
-        m_programs[2] =
-            make_program(VERTEX_SOURCE, GRAY_PASSTHROUGH_FRAGMENT_SOURCE);
+    // Shaders are only compiled by the first camera to start, but each
+    // camera links its own programs so their uniforms don't clash
+    std::string defines = std::string("#define INPUT ") +
+                          (m_mono ? "rrr" : "rgb") +
+                          "\n#define OUTPUT(color, result) gl_FragColor = " +
+                          (m_resultOnly ? "vec4(result)"
+                                        : "vec4((color).bgr, result)") +
+                          "\n#define MAX_HSV_RANGES " +
+                          std::to_string(MAX_HSV_RANGES) + "\n";
+    auto fragment = [&](const char *source) {
+        return withDefines(source, defines);
+    };
+    m_programs = {
+        m_gpu->program(VERTEX_SOURCE, fragment(NONE_FRAGMENT_SOURCE)),
+        m_gpu->program(VERTEX_SOURCE, fragment(HSV_FRAGMENT_SOURCE)),
+        m_gpu->program(VERTEX_SOURCE,
+                       fragment(m_mono ? GRAY_FRAGMENT_SOURCE
+                                       : GRAY_PASSTHROUGH_FRAGMENT_SOURCE)),
+        m_gpu->program(VERTEX_SOURCE, TILING_FRAGMENT_SOURCE),
+        m_gpu->program(VERTEX_SOURCE, fragment(THRESHOLDING_FRAGMENT_SOURCE)),
+        m_gpu->program(VERTEX_SOURCE, fragment(MULTI_FRAGMENT_SOURCE)),
+        m_gpu->program(VERTEX_SOURCE, fragment(HSV_RANGES_FRAGMENT_SOURCE)),
+    };
+
+    // Our size never changes
+    glUseProgram(m_programs[3].id);
+    glUniform2f(m_programs[3].resolutionIn, m_width, m_height);
+    GLERROR();
+    glUseProgram(m_programs[4].id);
+    glUniform2f(m_programs[4].tileResolution, m_width / 4, m_height / 4);
+    GLERROR();
+    glUseProgram(0);
+
+    {
+        // Anything returned after the last stop is stale
+        std::scoped_lock lock(m_renderable_mutex);
+        m_renderable = {};
     }
-    m_programs[3] = make_program(VERTEX_SOURCE, TILING_FRAGMENT_SOURCE);
-    m_programs[4] = make_program(VERTEX_SOURCE, THRESHOLDING_FRAGMENT_SOURCE);
 
+    const EGLint output_format =
+        m_resultOnly ? DRM_FORMAT_R8 : DRM_FORMAT_ABGR8888;
     for (auto fd : output_buf_fds) {
         GLuint out_tex;
         glGenTextures(1, &out_tex);
@@ -180,13 +175,14 @@ void GlHsvThresholder::start(const std::vector<int> &output_buf_fds) {
                                         EGL_HEIGHT,
                                         static_cast<EGLint>(m_height),
                                         EGL_LINUX_DRM_FOURCC_EXT,
-                                        DRM_FORMAT_ABGR8888,
+                                        output_format,
                                         EGL_DMA_BUF_PLANE0_FD_EXT,
                                         static_cast<EGLint>(fd),
                                         EGL_DMA_BUF_PLANE0_OFFSET_EXT,
                                         0,
                                         EGL_DMA_BUF_PLANE0_PITCH_EXT,
-                                        static_cast<EGLint>(m_width * 4),
+                                        static_cast<EGLint>(m_width *
+                                                            outputChannels()),
                                         EGL_NONE};
         auto image =
             eglCreateImageKHR(m_display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT,
@@ -217,29 +213,16 @@ void GlHsvThresholder::start(const std::vector<int> &output_buf_fds) {
             throw std::runtime_error("failed to complete framebuffer");
         }
 
+        m_output_textures.push_back(out_tex);
         m_framebuffers.emplace(fd, framebuffer);
-        m_renderable.push(fd);
+        if (std::find(busy.begin(), busy.end(), fd) == busy.end()) {
+            m_renderable.push(fd);
+        }
     }
     glBindTexture(GL_TEXTURE_2D, 0);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-    {
-        static GLfloat quad_varray[] = {
-            -1.0f, -1.0f, 1.0f, 1.0f, 1.0f,  -1.0f,
-            -1.0f, 1.0f,  1.0f, 1.0f, -1.0f, -1.0f,
-        };
-
-        GLuint quad_vbo;
-        glGenBuffers(1, &quad_vbo);
-        GLERROR();
-        glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
-        GLERROR();
-        glBufferData(GL_ARRAY_BUFFER, sizeof(quad_varray), quad_varray,
-                     GL_STATIC_DRAW);
-        GLERROR();
-
-        m_quad_vbo = quad_vbo;
-    }
+    m_quad_vbo = m_gpu->quadVbo();
 
     {
         GLuint grayscale_texture;
@@ -314,18 +297,49 @@ void GlHsvThresholder::start(const std::vector<int> &output_buf_fds) {
 
         m_min_max_framebuffer = min_max_framebuffer;
     }
+
+    for (const auto &input : input_bufs) {
+        importInput(input, encoding, range);
+    }
+    glBindTexture(GL_TEXTURE_EXTERNAL_OES, 0);
 }
 
 void GlHsvThresholder::release() {
+    // Textures live in the share group, so they'd outlive our context if we
+    // didn't delete them here
+    for (const auto &[key, texture] : m_input_textures) {
+        glDeleteTextures(1, &texture);
+    }
+    m_input_textures.clear();
+
+    for (const auto &[fd, framebuffer] : m_framebuffers) {
+        glDeleteFramebuffers(1, &framebuffer);
+    }
+    m_framebuffers.clear();
+    glDeleteTextures(m_output_textures.size(), m_output_textures.data());
+    m_output_textures.clear();
+
+    for (const auto &program : m_programs) {
+        glDeleteProgram(program.id);
+    }
+    m_programs.clear();
+
+    glDeleteFramebuffers(1, &m_grayscale_buffer);
+    glDeleteTextures(1, &m_grayscale_texture);
+    glDeleteFramebuffers(1, &m_min_max_framebuffer);
+    glDeleteTextures(1, &m_min_max_texture);
+    m_grayscale_buffer = m_grayscale_texture = 0;
+    m_min_max_framebuffer = m_min_max_texture = 0;
+
     if (!eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
                         EGL_NO_CONTEXT)) {
         throw std::runtime_error("failed to bind egl context");
     }
 }
 
-int GlHsvThresholder::testFrame(
+GLuint GlHsvThresholder::importInput(
     const std::array<GlHsvThresholder::DmaBufPlaneData, 3> &yuv_plane_data,
-    EGLint encoding, EGLint range, ProcessType type) {
+    EGLint encoding, EGLint range) {
     static auto glEGLImageTargetTexture2DOES =
         (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)eglGetProcAddress(
             "glEGLImageTargetTexture2DOES");
@@ -339,19 +353,21 @@ int GlHsvThresholder::testFrame(
             "cannot get address of glEGLImageTargetTexture2DOES");
     }
 
-    int framebuffer_fd;
-    {
-        std::scoped_lock lock(m_renderable_mutex);
-        if (!m_renderable.empty()) {
-            framebuffer_fd = m_renderable.front();
-            m_renderable.pop();
-        } else {
-            return 0;
-        }
-    }
-
-    // Begin code setup that does not change with type
-
+    // The chroma planes of a mono sensor's frames are all 128, so only the
+    // Y plane is worth sampling
+    EGLint mono_attribs[] = {EGL_WIDTH,
+                             m_width,
+                             EGL_HEIGHT,
+                             m_height,
+                             EGL_LINUX_DRM_FOURCC_EXT,
+                             DRM_FORMAT_R8,
+                             EGL_DMA_BUF_PLANE0_FD_EXT,
+                             yuv_plane_data[0].fd,
+                             EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+                             yuv_plane_data[0].offset,
+                             EGL_DMA_BUF_PLANE0_PITCH_EXT,
+                             yuv_plane_data[0].pitch,
+                             EGL_NONE};
     EGLint attribs[] = {EGL_WIDTH,
                         m_width,
                         EGL_HEIGHT,
@@ -382,8 +398,9 @@ int GlHsvThresholder::testFrame(
                         range,
                         EGL_NONE};
 
-    auto image = eglCreateImageKHR(m_display, EGL_NO_CONTEXT,
-                                   EGL_LINUX_DMA_BUF_EXT, nullptr, attribs);
+    auto image =
+        eglCreateImageKHR(m_display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT,
+                          nullptr, m_mono ? mono_attribs : attribs);
     EGLERROR();
     if (!image) {
         throw std::runtime_error("failed to import fd " +
@@ -403,34 +420,94 @@ int GlHsvThresholder::testFrame(
     GLERROR();
     eglDestroyImageKHR(m_display, image);
     EGLERROR();
-    // End portion of code that does not change with type
 
-    GLuint initial_program = -1;
+    // The texture holds its own reference to the image's storage, so it stays
+    // valid until the texture is deleted in release()
+    m_input_textures.emplace(inputKey(yuv_plane_data[0]), texture);
+    return texture;
+}
+
+GlHsvThresholder::RenderedFrame GlHsvThresholder::testFrame(
+    const std::array<GlHsvThresholder::DmaBufPlaneData, 3> &yuv_plane_data,
+    EGLint encoding, EGLint range, ProcessType type) {
+    int framebuffer_fd;
+    {
+        std::scoped_lock lock(m_renderable_mutex);
+        if (!m_renderable.empty()) {
+            framebuffer_fd = m_renderable.front();
+            m_renderable.pop();
+        } else {
+            return {0, EGL_NO_SYNC_KHR, -1};
+        }
+    }
+
+    GLuint texture;
+    {
+        auto it = m_input_textures.find(inputKey(yuv_plane_data[0]));
+        if (it != m_input_textures.end()) {
+            texture = it->second;
+        } else {
+            // Not one of the buffers we were started with, import it now and
+            // keep it around for next time
+            texture = importInput(yuv_plane_data, encoding, range);
+        }
+    }
+
+    GlProgram *initial_program = nullptr;
 
     if (type == ProcessType::None) {
-        initial_program = m_programs[0];
+        initial_program = &m_programs[0];
     } else if (type == ProcessType::Hsv) {
-        initial_program = m_programs[1];
+        initial_program = &m_programs[1];
     } else if (type == ProcessType::Gray || type == ProcessType::Adaptive) {
-        initial_program = m_programs[2];
+        initial_program = &m_programs[2];
+    } else if (type == ProcessType::Multi) {
+        initial_program = &m_programs[5];
+    } else if (type == ProcessType::HsvRanges) {
+        initial_program = &m_programs[6];
     }
 
-    glUseProgram(initial_program);
-    GLERROR();
-    glUniform1i(glGetUniformLocation(initial_program, "tex"), 0);
+    glUseProgram(initial_program->id);
     GLERROR();
 
-    if (type == ProcessType::Hsv) {
-        auto lll = glGetUniformLocation(initial_program, "lowerThresh");
-        auto uuu = glGetUniformLocation(initial_program, "upperThresh");
-        auto invert = glGetUniformLocation(initial_program, "invertHue");
-
-        std::lock_guard lock{m_hsv_mutex};
-        glUniform3f(lll, m_hsvLower[0], m_hsvLower[1], m_hsvLower[2]);
+    // Only upload thresholds when they've changed
+    if ((type == ProcessType::Hsv || type == ProcessType::Multi ||
+         type == ProcessType::HsvRanges) &&
+        initial_program->claimUniforms(m_hsvGeneration.load())) {
+        float lower[MAX_HSV_RANGES * 3];
+        float upper[MAX_HSV_RANGES * 3];
+        GLint invert[MAX_HSV_RANGES];
+        float values[MAX_HSV_RANGES];
+        int count = 1; // Hsv's uniforms are just range 0
+        bool bitmask;
+        {
+            std::lock_guard lock{m_hsv_mutex};
+            if (type == ProcessType::Multi) {
+                count = MULTI_HSV_RANGES;
+            } else if (type == ProcessType::HsvRanges) {
+                count = m_hsvRangeCount;
+            }
+            bitmask = m_hsvEncoding == HsvEncoding::Bitmask;
+            for (int i = 0; i < count; i++) {
+                const HsvRange &hsv = m_hsvRanges[i];
+                std::copy_n(hsv.lower, 3, lower + i * 3);
+                std::copy_n(hsv.upper, 3, upper + i * 3);
+                invert[i] = hsv.invertHue;
+                values[i] = (bitmask ? 1 << i : hsv.label) / 255.0f;
+            }
+        }
+        glUniform3fv(initial_program->lowerThresh, count, lower);
         GLERROR();
-        glUniform3f(uuu, m_hsvUpper[0], m_hsvUpper[1], m_hsvUpper[2]);
+        glUniform3fv(initial_program->upperThresh, count, upper);
         GLERROR();
-        glUniform1i(invert, m_invertHue);
+        glUniform1iv(initial_program->invertHue, count, invert);
+        GLERROR();
+        // Only HsvRanges has these
+        glUniform1fv(initial_program->hsvValues, count, values);
+        GLERROR();
+        glUniform1i(initial_program->hsvRangeCount, count);
+        GLERROR();
+        glUniform1i(initial_program->hsvBitmask, bitmask);
         GLERROR();
     }
 
@@ -442,13 +519,13 @@ int GlHsvThresholder::testFrame(
     glBindBuffer(GL_ARRAY_BUFFER, m_quad_vbo);
     GLERROR();
 
-    auto attr_loc = glGetAttribLocation(initial_program, "vertex");
-    glEnableVertexAttribArray(attr_loc);
+    glEnableVertexAttribArray(initial_program->vertex);
     GLERROR();
-    glVertexAttribPointer(attr_loc, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+    glVertexAttribPointer(initial_program->vertex, 2, GL_FLOAT, GL_FALSE, 0,
+                          nullptr);
     GLERROR();
 
-    if (type != ProcessType::Adaptive) {
+    if (type != ProcessType::Adaptive && type != ProcessType::Multi) {
         auto out_framebuffer = m_framebuffers.at(framebuffer_fd);
         glBindFramebuffer(GL_FRAMEBUFFER, out_framebuffer);
         GLERROR();
@@ -461,13 +538,7 @@ int GlHsvThresholder::testFrame(
         glDrawArrays(GL_TRIANGLES, 0, 6);
         GLERROR();
 
-        glFinish();
-        GLERROR();
-
-        glDeleteTextures(1, &texture);
-        GLERROR();
-
-        return framebuffer_fd;
+        return fenceFrame(framebuffer_fd);
     } else {
         glBindFramebuffer(GL_FRAMEBUFFER, m_grayscale_buffer);
         GLERROR();
@@ -494,24 +565,12 @@ int GlHsvThresholder::testFrame(
         glBindTexture(GL_TEXTURE_2D, m_grayscale_texture);
         GLERROR();
 
-        glUseProgram(m_programs[3]);
-        GLERROR();
-
-        glUniform1i(glGetUniformLocation(m_programs[3], "tex"), 0);
-        GLERROR();
-
-        auto res = glGetUniformLocation(m_programs[3], "resolution_in");
-        GLERROR();
-        glUniform2f(res, m_width, m_height);
+        glUseProgram(m_programs[3].id);
         GLERROR();
 
         glDrawArrays(GL_TRIANGLES, 0, 6);
         GLERROR();
 
-        // TODO: This finish may be unneeded
-        glFinish();
-        GLERROR();
-
         auto out_framebuffer = m_framebuffers.at(framebuffer_fd);
         glBindFramebuffer(GL_FRAMEBUFFER, out_framebuffer);
         GLERROR();
@@ -522,12 +581,7 @@ int GlHsvThresholder::testFrame(
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         GLERROR();
 
-        glUseProgram(m_programs[4]);
-        GLERROR();
-
-        glUniform1i(glGetUniformLocation(m_programs[4], "tex"), 0);
-        GLERROR();
-        glUniform1i(glGetUniformLocation(m_programs[4], "tiles"), 1);
+        glUseProgram(m_programs[4].id);
         GLERROR();
 
         glActiveTexture(GL_TEXTURE0);
@@ -540,18 +594,66 @@ int GlHsvThresholder::testFrame(
         glBindTexture(GL_TEXTURE_2D, m_min_max_texture);
         GLERROR();
 
-        auto tile_res = glGetUniformLocation(m_programs[4], "tile_resolution");
-        GLERROR();
-        glUniform2f(tile_res, m_width / 4, m_height / 4);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
         GLERROR();
 
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+        return fenceFrame(framebuffer_fd);
+    }
+}
+
+GlHsvThresholder::RenderedFrame
+GlHsvThresholder::fenceFrame(int framebuffer_fd) {
+    static auto eglCreateSyncKHR =
+        (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+    static auto eglDestroySyncKHR =
+        (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+    static auto eglDupNativeFenceFDANDROID =
+        (PFNEGLDUPNATIVEFENCEFDANDROIDPROC)eglGetProcAddress(
+            "eglDupNativeFenceFDANDROID");
+
+    if (m_hasNativeFence) {
+        auto sync = eglCreateSyncKHR(m_display, EGL_SYNC_NATIVE_FENCE_ANDROID,
+                                     nullptr);
+        EGLERROR();
+        // The fence fd only exists once the fence has been flushed
+        glFlush();
         GLERROR();
+        int fence_fd = eglDupNativeFenceFDANDROID(m_display, sync);
+        eglDestroySyncKHR(m_display, sync);
+        if (fence_fd >= 0) {
+            return {framebuffer_fd, EGL_NO_SYNC_KHR, fence_fd};
+        }
+    }
 
-        glFinish();
+    if (m_hasFenceSync) {
+        auto sync = eglCreateSyncKHR(m_display, EGL_SYNC_FENCE_KHR, nullptr);
+        EGLERROR();
+        glFlush();
         GLERROR();
+        return {framebuffer_fd, sync, -1};
+    }
+
+    glFinish();
+    GLERROR();
+    return {framebuffer_fd, EGL_NO_SYNC_KHR, -1};
+}
 
-        return framebuffer_fd;
+void GlHsvThresholder::waitForRender(const RenderedFrame &frame) {
+    static auto eglClientWaitSyncKHR =
+        (PFNEGLCLIENTWAITSYNCKHRPROC)eglGetProcAddress("eglClientWaitSyncKHR");
+    static auto eglDestroySyncKHR =
+        (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+
+    if (frame.fence_fd >= 0) {
+        struct pollfd pfd{};
+        pfd.fd = frame.fence_fd;
+        pfd.events = POLLIN;
+        while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+        }
+        close(frame.fence_fd);
+    } else if (frame.fence != EGL_NO_SYNC_KHR) {
+        eglClientWaitSyncKHR(m_display, frame.fence, 0, EGL_FOREVER_KHR);
+        eglDestroySyncKHR(m_display, frame.fence);
     }
 }
 
@@ -563,13 +665,46 @@ void GlHsvThresholder::returnBuffer(int fd) {
 void GlHsvThresholder::setHsvThresholds(double hl, double sl, double vl,
                                         double hu, double su, double vu,
                                         bool hueInverted) {
+    setHsvRange(0, hl, sl, vl, hu, su, vu, hueInverted);
+}
+
+void GlHsvThresholder::setHsvRange(int range, double hl, double sl, double vl,
+                                   double hu, double su, double vu,
+                                   bool hueInverted) {
+    if (range < 0 || range >= MAX_HSV_RANGES) {
+        throw std::runtime_error("no HSV range " + std::to_string(range));
+    }
+
+    std::lock_guard lock{m_hsv_mutex};
+    HsvRange &hsv = m_hsvRanges[range];
+    hsv.lower[0] = hl;
+    hsv.lower[1] = sl;
+    hsv.lower[2] = vl;
+
+    hsv.upper[0] = hu;
+    hsv.upper[1] = su;
+    hsv.upper[2] = vu;
+    hsv.invertHue = hueInverted;
+    m_hsvGeneration++;
+}
+
+void GlHsvThresholder::setHsvRanges(const std::vector<HsvRange> &ranges,
+                                    HsvEncoding encoding) {
+    if (ranges.size() > MAX_HSV_RANGES) {
+        throw std::runtime_error("at most " + std::to_string(MAX_HSV_RANGES) +
+                                 " HSV ranges");
+    }
+    if (encoding == HsvEncoding::Label) {
+        for (const auto &range : ranges) {
+            if (range.label == 0) {
+                throw std::runtime_error("HSV range label 0 means no match");
+            }
+        }
+    }
+
     std::lock_guard lock{m_hsv_mutex};
-    m_hsvLower[0] = hl;
-    m_hsvLower[1] = sl;
-    m_hsvLower[2] = vl;
-
-    m_hsvUpper[0] = hu;
-    m_hsvUpper[1] = su;
-    m_hsvUpper[2] = vu;
-    m_invertHue = hueInverted;
+    std::copy(ranges.begin(), ranges.end(), m_hsvRanges.begin());
+    m_hsvRangeCount = ranges.size();
+    m_hsvEncoding = encoding;
+    m_hsvGeneration++;
 }
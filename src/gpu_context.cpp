@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "gpu_context.h"
+
+#include <cstdio>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+#include "glerror.h"
+
+GLuint make_shader(GLenum type, const char *source) {
+    auto shader = glCreateShader(type);
+
+    // void *ctx = eglGetCurrentContext();
+    // std::printf("Shader idx: %i context ptr: %lu\n", (int) shader,
+    // (size_t)ctx);
+
+    if (!shader) {
+        throw std::runtime_error("failed to create shader");
+    }
+    glShaderSource(shader, 1, &source, nullptr);
+    GLERROR();
+    glCompileShader(shader);
+    GLERROR();
+
+    GLint status;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status) {
+        GLint log_size;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &log_size);
+
+        std::string out;
+        out.resize(log_size);
+        glGetShaderInfoLog(shader, log_size, nullptr, out.data());
+
+        glDeleteShader(shader);
+        std::printf("Shader:\n%s\n", source);
+        throw std::runtime_error("failed to compile shader with error: " + out);
+    }
+
+    return shader;
+}
+
+GLuint link_program(GLuint vertex_shader, GLuint fragment_shader) {
+    auto program = glCreateProgram();
+    glAttachShader(program, vertex_shader);
+    GLERROR();
+    glAttachShader(program, fragment_shader);
+    GLERROR();
+    glLinkProgram(program);
+    GLERROR();
+
+    GLint status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status) {
+        GLint log_size;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &log_size);
+
+        std::string out;
+        out.resize(log_size);
+        glGetProgramInfoLog(program, log_size, nullptr, out.data());
+
+        glDeleteProgram(program);
+        throw std::runtime_error("failed to link program with error: " + out);
+    }
+    glDetachShader(program, vertex_shader);
+    glDetachShader(program, fragment_shader);
+
+    return program;
+}
+
+GLuint make_program(const char *vertex_source, const char *fragment_source) {
+    auto vertex_shader = make_shader(GL_VERTEX_SHADER, vertex_source);
+    auto fragment_shader = make_shader(GL_FRAGMENT_SHADER, fragment_source);
+
+    GLuint program;
+    try {
+        program = link_program(vertex_shader, fragment_shader);
+    } catch (...) {
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
+        throw;
+    }
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+
+    return program;
+}
+
+static std::mutex g_cacheDirectoryMutex;
+static std::optional<std::string> g_cacheDirectory;
+
+void GpuContext::setProgramCacheDirectory(const std::string &directory) {
+    std::lock_guard<std::mutex> lock{g_cacheDirectoryMutex};
+    g_cacheDirectory = directory;
+}
+
+static std::string programCacheDirectory() {
+    std::lock_guard<std::mutex> lock{g_cacheDirectoryMutex};
+    return g_cacheDirectory.value_or(ProgramCache::defaultDirectory());
+}
+
+std::shared_ptr<GpuContext> GpuContext::acquire() {
+    static std::mutex mutex;
+    static std::weak_ptr<GpuContext> current;
+
+    std::lock_guard<std::mutex> lock{mutex};
+    auto context = current.lock();
+    if (!context) {
+        context = std::shared_ptr<GpuContext>(new GpuContext());
+        current = context;
+    }
+    return context;
+}
+
+GpuContext::GpuContext()
+    : m_headless(createHeadless()), m_cache(programCacheDirectory()) {}
+
+GpuContext::~GpuContext() {
+    // Shared objects need a context in the share group to be deleted from
+    if (eglMakeCurrent(m_headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                       m_headless.context)) {
+        for (const auto &[source, shader] : m_shaders) {
+            glDeleteShader(shader);
+        }
+        glDeleteBuffers(1, &m_quadVbo);
+        eglMakeCurrent(m_headless.display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                       EGL_NO_CONTEXT);
+    }
+    destroyHeadless(m_headless);
+}
+
+EGLContext GpuContext::createContext() {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    return createSharedContext(m_headless);
+}
+
+void GpuContext::destroyContext(EGLContext context) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    eglDestroyContext(m_headless.display, context);
+}
+
+GlProgram GpuContext::program(const std::string &vertexSource,
+                              const std::string &fragmentSource) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    GLuint program = m_cache.load(vertexSource, fragmentSource);
+    if (!program) {
+        auto shader = [&](GLenum type, const std::string &source) {
+            auto key = std::make_pair(type, source);
+            auto it = m_shaders.find(key);
+            if (it == m_shaders.end()) {
+                it = m_shaders
+                         .emplace(std::move(key),
+                                  make_shader(type, source.c_str()))
+                         .first;
+            }
+            return it->second;
+        };
+        program = link_program(shader(GL_VERTEX_SHADER, vertexSource),
+                               shader(GL_FRAGMENT_SHADER, fragmentSource));
+        m_cache.store(program, vertexSource, fragmentSource);
+    }
+
+    GlProgram ret(program);
+    glUseProgram(ret.id);
+    glUniform1i(ret.tex, 0);
+    glUniform1i(ret.tiles, 1);
+    glUseProgram(0);
+    GLERROR();
+    return ret;
+}
+
+GLuint GpuContext::quadVbo() {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    if (m_quadVbo) {
+        return m_quadVbo;
+    }
+
+    static const GLfloat quad_varray[] = {
+        -1.0f, -1.0f, 1.0f, 1.0f, 1.0f,  -1.0f,
+        -1.0f, 1.0f,  1.0f, 1.0f, -1.0f, -1.0f,
+    };
+
+    glGenBuffers(1, &m_quadVbo);
+    GLERROR();
+    glBindBuffer(GL_ARRAY_BUFFER, m_quadVbo);
+    GLERROR();
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad_varray), quad_varray,
+                 GL_STATIC_DRAW);
+    GLERROR();
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return m_quadVbo;
+}
@@ -63,6 +63,30 @@ static const EGLint contextAttribs[] = {
     EGL_CONTEXT_CLIENT_VERSION, 2, EGL_CONTEXT_FLAGS_KHR,
     EGL_CONTEXT_OPENGL_DEBUG_BIT_KHR, EGL_NONE};
 
+// Tear down whatever part of the GBM device we managed to set up. Both are
+// absent when we're running on the surfaceless platform.
+static void closeDevice(gbm_device *gbmDevice, int device) {
+    if (gbmDevice) {
+        gbm_device_destroy(gbmDevice);
+    }
+    if (device != -1) {
+        close(device);
+    }
+}
+
+// With no DRM device to render on (e.g. a build box without a GPU), fall back
+// to Mesa's surfaceless platform, which gets us llvmpipe
+static EGLDisplay getSurfacelessDisplay() {
+    static auto eglGetPlatformDisplayEXT =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+            "eglGetPlatformDisplayEXT");
+    if (!eglGetPlatformDisplayEXT) {
+        return EGL_NO_DISPLAY;
+    }
+    return eglGetPlatformDisplayEXT(EGL_PLATFORM_SURFACELESS_MESA,
+                                    EGL_DEFAULT_DISPLAY, nullptr);
+}
+
 HeadlessData createHeadless() {
     std::vector<std::string> paths = {"/dev/dri/card1", "/dev/dri/card0"};
     int device = -1;
@@ -73,28 +97,29 @@ HeadlessData createHeadless() {
         }
     }
 
-    // no device could be opened
-    if (device == -1) {
-        throw std::runtime_error("Unable to open graphics fd");
-    }
-
-    gbm_device *gbmDevice = gbm_create_device(device);
-    if (gbmDevice == nullptr) {
-        throw std::runtime_error("Unable to create GBM device");
+    gbm_device *gbmDevice = nullptr;
+    EGLDisplay display;
+    if (device != -1) {
+        gbmDevice = gbm_create_device(device);
+        if (gbmDevice == nullptr) {
+            close(device);
+            throw std::runtime_error("Unable to create GBM device");
+        }
+        display = eglGetDisplay((EGLNativeDisplayType)gbmDevice);
+    } else {
+        std::printf("No graphics device, trying surfaceless EGL\n");
+        display = getSurfacelessDisplay();
     }
 
-    EGLDisplay display = eglGetDisplay((EGLNativeDisplayType)gbmDevice);
     if (display == EGL_NO_DISPLAY) {
-        gbm_device_destroy(gbmDevice);
-        close(device);
+        closeDevice(gbmDevice, device);
         throw std::runtime_error("Unable to get EGL display");
     }
 
     int major, minor;
     if (eglInitialize(display, &major, &minor) == EGL_FALSE) {
         eglTerminate(display);
-        gbm_device_destroy(gbmDevice);
-        close(device);
+        closeDevice(gbmDevice, device);
         EGLERROR();
     }
 
@@ -111,28 +136,29 @@ HeadlessData createHeadless() {
 
     if (!eglChooseConfig(display, configAttribs, configs, count, &numConfigs)) {
         eglTerminate(display);
-        gbm_device_destroy(gbmDevice);
-        close(device);
+        closeDevice(gbmDevice, device);
         EGLERROR();
     }
 
     // I am not exactly sure why the EGL config must match the GBM format.
-    // But it works!
+    // But it works! Surfaceless configs have no native visual, and we never
+    // render to a surface anyways, so take the first one there.
     int configIndex =
-        matchConfigToVisual(display, GBM_FORMAT_XRGB8888, configs, numConfigs);
+        gbmDevice ? matchConfigToVisual(display, GBM_FORMAT_XRGB8888, configs,
+                                        numConfigs)
+                  : (numConfigs > 0 ? 0 : -1);
     if (configIndex < 0) {
         eglTerminate(display);
-        gbm_device_destroy(gbmDevice);
-        close(device);
+        closeDevice(gbmDevice, device);
         EGLERROR();
     }
 
-    EGLContext context = eglCreateContext(display, configs[configIndex],
-                                          EGL_NO_CONTEXT, contextAttribs);
+    EGLConfig config = configs[configIndex];
+    EGLContext context =
+        eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
     if (context == EGL_NO_CONTEXT) {
         eglTerminate(display);
-        gbm_device_destroy(gbmDevice);
-        close(device);
+        closeDevice(gbmDevice, device);
         EGLERROR();
     }
 
@@ -141,6 +167,7 @@ HeadlessData createHeadless() {
     HeadlessData ret{.gbmFd = device,
                      .gbmDevice = gbmDevice,
                      .display = display,
+                     .config = config,
                      .context = context};
 
     return ret;
@@ -151,6 +178,15 @@ void destroyHeadless(HeadlessData status) {
     std::cout << "Destroying headless" << std::endl;
     eglDestroyContext(status.display, status.context);
     eglTerminate(status.display);
-    gbm_device_destroy(status.gbmDevice);
-    close(status.gbmFd);
+    closeDevice(status.gbmDevice, status.gbmFd);
+}
+
+EGLContext createSharedContext(HeadlessData status) {
+    EGLContext context = eglCreateContext(status.display, status.config,
+                                          status.context, contextAttribs);
+    if (context == EGL_NO_CONTEXT) {
+        EGLERROR();
+        throw std::runtime_error("Unable to create shared EGL context");
+    }
+    return context;
 }
@@ -36,15 +36,23 @@
 
 #include <libcamera/property_ids.h>
 
+#include <cstdio>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <stdexcept>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "camera_group.h"
 #include "camera_manager.h"
 #include "camera_model.h"
 #include "camera_runner.h"
+#include "gpu_context.h"
 #include "headless_opengl.h"
+#include "replay_frame_source.h"
+#include "sensor_modes.h"
 
 extern "C" {
 
@@ -59,6 +67,25 @@ Java_org_photonvision_raspi_LibCameraJNI_isLibraryWorking(JNIEnv *, jclass) {
     return true;
 }
 
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    setShaderCacheDirectory
+ * Signature: (Ljava/lang/String;)Z
+ */
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_setShaderCacheDirectory
+  (JNIEnv *env, jclass, jstring directory)
+{
+    if (!directory) {
+        return false;
+    }
+
+    const char *c_directory = env->GetStringUTFChars(directory, 0);
+    GpuContext::setProgramCacheDirectory(c_directory);
+    env->ReleaseStringUTFChars(directory, c_directory);
+    return true;
+}
+
 /*
  * Class:     org_photonvision_raspi_LibCameraJNI
  * Method:    getCameraNames
@@ -88,6 +115,33 @@ Java_org_photonvision_raspi_LibCameraJNI_getCameraNames
     return (ret);
 }
 
+static jlong createRunner(JNIEnv *env, jstring name, jint width, jint height,
+                          jint rotation, const RunnerOptions &options) {
+    std::vector<std::shared_ptr<libcamera::Camera>> cameras = GetAllCameraIDs();
+
+    const char *c_name = env->GetStringUTFChars(name, 0);
+
+    jlong ret = 0;
+
+    // Find our camera by name
+    for (auto &c : cameras) {
+        if (std::strcmp(c->id().c_str(), c_name) == 0) {
+            try {
+                ret = reinterpret_cast<jlong>(
+                    new CameraRunner(width, height, rotation, c, options));
+            } catch (const std::runtime_error &e) {
+                std::printf("Failed to create camera %s: %s\n", c_name,
+                            e.what());
+            }
+            break;
+        }
+    }
+
+    env->ReleaseStringUTFChars(name, c_name);
+
+    return ret;
+}
+
 /*
  * Class:     org_photonvision_raspi_LibCameraJNI
  * Method:    createCamera
@@ -96,24 +150,120 @@ Java_org_photonvision_raspi_LibCameraJNI_getCameraNames
 JNIEXPORT jlong JNICALL
 Java_org_photonvision_raspi_LibCameraJNI_createCamera
   (JNIEnv *env, jclass, jstring name, jint width, jint height, jint rotation)
+{
+    return createRunner(env, name, width, height, rotation, {});
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    createCameraWithOptions
+ * Signature: (Ljava/lang/String;IIIIIZIIIIII)J
+ */
+JNIEXPORT jlong JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_createCameraWithOptions
+  (JNIEnv *env, jclass, jstring name, jint width, jint height, jint rotation,
+   jint cameraBufferCount, jint outputBufferCount, jboolean dropStaleFrames,
+   jint sensorWidth, jint sensorHeight, jint sensorBitDepth,
+   jint processWidth, jint processHeight, jint outputFormat)
+{
+    if (cameraBufferCount < 0 || sensorWidth < 0 || sensorHeight < 0 ||
+        sensorBitDepth < 0 || processWidth < 0 || processHeight < 0 ||
+        processWidth > width || processHeight > height) {
+        return 0;
+    }
+
+    RunnerOptions options;
+    options.cameraBufferCount = cameraBufferCount;
+    options.outputBufferCount = outputBufferCount;
+    options.dropStaleFrames = dropStaleFrames;
+    // A zero size leaves the choice of sensor mode to libcamera
+    if (sensorWidth > 0 && sensorHeight > 0) {
+        SensorMode mode{};
+        mode.width = sensorWidth;
+        mode.height = sensorHeight;
+        mode.bitDepth = sensorBitDepth;
+        options.sensorMode = mode;
+    }
+    // Likewise, a zero size processes frames at the full size
+    if (processWidth > 0 && processHeight > 0) {
+        options.processSize = libcamera::Size(processWidth, processHeight);
+    }
+    // Range checked by the runner
+    options.outputFormat = static_cast<OutputFormat>(outputFormat);
+    return createRunner(env, name, width, height, rotation, options);
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    getSensorModesRaw
+ * Signature: (Ljava/lang/String;)[D
+ */
+JNIEXPORT jdoubleArray JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_getSensorModesRaw
+  (JNIEnv *env, jclass, jstring name)
 {
     std::vector<std::shared_ptr<libcamera::Camera>> cameras = GetAllCameraIDs();
 
     const char *c_name = env->GetStringUTFChars(name, 0);
 
-    jlong ret = 0;
-
-    // Find our camera by name
+    std::vector<SensorMode> modes;
     for (auto &c : cameras) {
         if (std::strcmp(c->id().c_str(), c_name) == 0) {
-            ret = reinterpret_cast<jlong>(
-                new CameraRunner(width, height, rotation, c));
+            try {
+                modes = enumerateSensorModes(c);
+            } catch (const std::runtime_error &e) {
+                std::printf("Failed to list sensor modes of %s: %s\n", c_name,
+                            e.what());
+                env->ReleaseStringUTFChars(name, c_name);
+                return nullptr;
+            }
             break;
         }
     }
 
     env->ReleaseStringUTFChars(name, c_name);
 
+    // Flattened as 8 values per mode, in SensorMode's field order
+    std::vector<jdouble> flat;
+    flat.reserve(modes.size() * 8);
+    for (const auto &m : modes) {
+        flat.insert(flat.end(), {static_cast<jdouble>(m.width),
+                                 static_cast<jdouble>(m.height),
+                                 static_cast<jdouble>(m.bitDepth), m.maxFps,
+                                 static_cast<jdouble>(m.cropX),
+                                 static_cast<jdouble>(m.cropY),
+                                 static_cast<jdouble>(m.cropWidth),
+                                 static_cast<jdouble>(m.cropHeight)});
+    }
+
+    jdoubleArray ret = env->NewDoubleArray(flat.size());
+    if (ret) {
+        env->SetDoubleArrayRegion(ret, 0, flat.size(), flat.data());
+    }
+    return ret;
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    createReplayCamera
+ * Signature: (Ljava/lang/String;DZ)J
+ */
+JNIEXPORT jlong JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_createReplayCamera
+  (JNIEnv *env, jclass, jstring path, jdouble fps, jboolean loop)
+{
+    const char *c_path = env->GetStringUTFChars(path, 0);
+
+    jlong ret = 0;
+    try {
+        ret = reinterpret_cast<jlong>(new CameraRunner(
+            std::make_unique<ReplayFrameSource>(c_path, fps, loop)));
+    } catch (const std::runtime_error &e) {
+        std::printf("Failed to open replay %s: %s\n", c_path, e.what());
+    }
+
+    env->ReleaseStringUTFChars(path, c_path);
+
     return ret;
 }
 
@@ -225,6 +375,83 @@ Java_org_photonvision_raspi_LibCameraJNI_setThresholds
     return true;
 }
 
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    setHsvRange
+ * Signature: (JIDDDDDDZ)Z
+ */
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_setHsvRange
+  (JNIEnv *, jclass, jlong runner_, jint range, jdouble hl, jdouble sl,
+   jdouble vl, jdouble hu, jdouble su, jdouble vu, jboolean hueInverted)
+{
+    CameraRunner *runner = reinterpret_cast<CameraRunner *>(runner_);
+    if (!runner) {
+        return false;
+    }
+
+    try {
+        runner->thresholder().setHsvRange(range, hl, sl, vl, hu, su, vu,
+                                          hueInverted);
+    } catch (const std::runtime_error &e) {
+        std::printf("Failed to set HSV range: %s\n", e.what());
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    setHsvRanges
+ * Signature: (J[D[Z[IZ)Z
+ */
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_setHsvRanges
+  (JNIEnv *env, jclass, jlong runner_, jdoubleArray thresholds_,
+   jbooleanArray hueInverted_, jintArray labels_, jboolean bitmask)
+{
+    CameraRunner *runner = reinterpret_cast<CameraRunner *>(runner_);
+    if (!runner || !thresholds_ || !hueInverted_ || !labels_) {
+        return false;
+    }
+
+    const jsize count = env->GetArrayLength(hueInverted_);
+    if (env->GetArrayLength(thresholds_) != count * 6 ||
+        env->GetArrayLength(labels_) != count) {
+        return false;
+    }
+
+    std::vector<jdouble> thresholds(count * 6);
+    std::vector<jboolean> hueInverted(count);
+    std::vector<jint> labels(count);
+    env->GetDoubleArrayRegion(thresholds_, 0, count * 6, thresholds.data());
+    env->GetBooleanArrayRegion(hueInverted_, 0, count, hueInverted.data());
+    env->GetIntArrayRegion(labels_, 0, count, labels.data());
+
+    std::vector<HsvRange> ranges;
+    for (jsize i = 0; i < count; i++) {
+        if (labels[i] < 0 || labels[i] > 255) {
+            return false;
+        }
+        const jdouble *t = &thresholds[i * 6];
+        ranges.push_back({{static_cast<float>(t[0]), static_cast<float>(t[1]),
+                           static_cast<float>(t[2])},
+                          {static_cast<float>(t[3]), static_cast<float>(t[4]),
+                           static_cast<float>(t[5])},
+                          static_cast<bool>(hueInverted[i]),
+                          static_cast<uint8_t>(labels[i])});
+    }
+
+    try {
+        runner->thresholder().setHsvRanges(
+            ranges, bitmask ? HsvEncoding::Bitmask : HsvEncoding::Label);
+    } catch (const std::runtime_error &e) {
+        std::printf("Failed to set HSV ranges: %s\n", e.what());
+        return false;
+    }
+    return true;
+}
+
 /*
  * Class:     org_photonvision_raspi_LibCameraJNI
  * Method:    setExposure
@@ -239,7 +466,8 @@ Java_org_photonvision_raspi_LibCameraJNI_setExposure
         return false;
     }
 
-    runner->cameraGrabber().cameraSettings().exposureTimeUs = exposure;
+    runner->frameSource().updateSettings(
+        [&](CameraSettings &settings) { settings.exposureTimeUs = exposure; });
     return true;
 }
 
@@ -257,7 +485,9 @@ Java_org_photonvision_raspi_LibCameraJNI_setAutoExposure
         return false;
     }
 
-    runner->cameraGrabber().cameraSettings().doAutoExposure = doAutoExposure;
+    runner->frameSource().updateSettings([&](CameraSettings &settings) {
+        settings.doAutoExposure = doAutoExposure;
+    });
     return true;
 }
 
@@ -275,7 +505,8 @@ Java_org_photonvision_raspi_LibCameraJNI_setSaturation
         return false;
     }
 
-    runner->cameraGrabber().cameraSettings().saturation = saturation;
+    runner->frameSource().updateSettings(
+        [&](CameraSettings &settings) { settings.saturation = saturation; });
     return true;
 }
 
@@ -293,7 +524,8 @@ Java_org_photonvision_raspi_LibCameraJNI_setBrightness
         return false;
     }
 
-    runner->cameraGrabber().cameraSettings().brightness = brightness;
+    runner->frameSource().updateSettings(
+        [&](CameraSettings &settings) { settings.brightness = brightness; });
     return true;
 }
 
@@ -311,8 +543,10 @@ Java_org_photonvision_raspi_LibCameraJNI_setAwbGain
         return false;
     }
 
-    runner->cameraGrabber().cameraSettings().awbRedGain = red;
-    runner->cameraGrabber().cameraSettings().awbBlueGain = blue;
+    runner->frameSource().updateSettings([&](CameraSettings &settings) {
+        settings.awbRedGain = red;
+        settings.awbBlueGain = blue;
+    });
     return true;
 }
 
@@ -330,10 +564,173 @@ Java_org_photonvision_raspi_LibCameraJNI_setAnalogGain
         return false;
     }
 
-    runner->cameraGrabber().cameraSettings().analogGain = analog;
+    runner->frameSource().updateSettings(
+        [&](CameraSettings &settings) { settings.analogGain = analog; });
+    return true;
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    setCameraSettings
+ * Signature: (JZIDDDDDD)Z
+ */
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_setCameraSettings
+  (JNIEnv *, jclass, jlong runner_, jboolean doAutoExposure, jint exposure,
+   jdouble analog, jdouble brightness, jdouble contrast, jdouble red,
+   jdouble blue, jdouble saturation)
+{
+    CameraRunner *runner = reinterpret_cast<CameraRunner *>(runner_);
+    if (!runner) {
+        return false;
+    }
+
+    // Settings this doesn't cover, like frame duration, are left as they are
+    runner->frameSource().updateSettings([&](CameraSettings &settings) {
+        settings.doAutoExposure = doAutoExposure;
+        settings.exposureTimeUs = exposure;
+        settings.analogGain = analog;
+        settings.brightness = brightness;
+        settings.contrast = contrast;
+        settings.awbRedGain = red;
+        settings.awbBlueGain = blue;
+        settings.saturation = saturation;
+    });
+    return true;
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    setFrameDurationLimits
+ * Signature: (JJJ)Z
+ */
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_setFrameDurationLimits
+  (JNIEnv *, jclass, jlong runner_, jlong minUs, jlong maxUs)
+{
+    CameraRunner *runner = reinterpret_cast<CameraRunner *>(runner_);
+    if (!runner || minUs <= 0 || minUs > maxUs) {
+        return false;
+    }
+
+    // Reject ranges the camera can't meet at all. Ones that just overlap
+    // its limits get clamped when they're sent to the camera.
+    auto limits = runner->frameSource().frameDurationLimits();
+    if (limits && (maxUs < limits->first || minUs > limits->second)) {
+        std::printf("Frame duration %lld-%lld us is outside the camera's "
+                    "%lld-%lld us\n",
+                    static_cast<long long>(minUs),
+                    static_cast<long long>(maxUs),
+                    static_cast<long long>(limits->first),
+                    static_cast<long long>(limits->second));
+        return false;
+    }
+
+    runner->frameSource().updateSettings([&](CameraSettings &settings) {
+        settings.minFrameDurationUs = minUs;
+        settings.maxFrameDurationUs = maxUs;
+    });
     return true;
 }
 
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    getFrameDurationLimits
+ * Signature: (J)[J
+ */
+JNIEXPORT jlongArray JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_getFrameDurationLimits
+  (JNIEnv *env, jclass, jlong runner_)
+{
+    CameraRunner *runner = reinterpret_cast<CameraRunner *>(runner_);
+    if (!runner) {
+        return nullptr;
+    }
+
+    auto limits = runner->frameSource().frameDurationLimits();
+    if (!limits) {
+        return nullptr;
+    }
+
+    jlong values[2] = {limits->first, limits->second};
+    jlongArray ret = env->NewLongArray(2);
+    if (ret) {
+        env->SetLongArrayRegion(ret, 0, 2, values);
+    }
+    return ret;
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    setRegionOfInterest
+ * Signature: (JIIIIZ)Z
+ */
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_setRegionOfInterest
+  (JNIEnv *, jclass, jlong runner_, jint x, jint y, jint width, jint height,
+   jboolean keepAspect)
+{
+    CameraRunner *runner = reinterpret_cast<CameraRunner *>(runner_);
+    if (!runner || width < 0 || height < 0 ||
+        !runner->frameSource().scalerCropMaximum()) {
+        return false;
+    }
+
+    runner->frameSource().updateSettings([&](CameraSettings &settings) {
+        settings.roi = {x, y, width, height};
+        settings.roiKeepAspect = keepAspect;
+    });
+    return true;
+}
+
+static jintArray toJava(JNIEnv *env, const CropRect &rect) {
+    jint values[4] = {rect.x, rect.y, rect.width, rect.height};
+    jintArray ret = env->NewIntArray(4);
+    if (ret) {
+        env->SetIntArrayRegion(ret, 0, 4, values);
+    }
+    return ret;
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    getScalerCropMaximum
+ * Signature: (J)[I
+ */
+JNIEXPORT jintArray JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_getScalerCropMaximum
+  (JNIEnv *env, jclass, jlong runner_)
+{
+    CameraRunner *runner = reinterpret_cast<CameraRunner *>(runner_);
+    if (!runner) {
+        return nullptr;
+    }
+
+    auto maximum = runner->frameSource().scalerCropMaximum();
+    if (!maximum) {
+        return nullptr;
+    }
+    return toJava(env, *maximum);
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    getFrameScalerCrop
+ * Signature: (J)[I
+ */
+JNIEXPORT jintArray JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_getFrameScalerCrop
+  (JNIEnv *env, jclass, jlong pair_)
+{
+    MatPair *pair = reinterpret_cast<MatPair *>(pair_);
+    if (!pair) {
+        return nullptr;
+    }
+
+    const cv::Rect &crop = pair->scalerCrop;
+    return toJava(env, {crop.x, crop.y, crop.width, crop.height});
+}
+
 /*
  * Class:     org_photonvision_raspi_LibCameraJNI
  * Method:    setFramesToCopy
@@ -352,6 +749,61 @@ Java_org_photonvision_raspi_LibCameraJNI_setFramesToCopy
     return true;
 }
 
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    setCopyFullRes
+ * Signature: (JZ)Z
+ */
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_setCopyFullRes
+  (JNIEnv *, jclass, jlong runner_, jboolean copyFullRes)
+{
+    CameraRunner *runner = reinterpret_cast<CameraRunner *>(runner_);
+    if (!runner) {
+        return false;
+    }
+
+    runner->setCopyFullRes(copyFullRes);
+    return true;
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    setZeroCopy
+ * Signature: (JZZ)Z
+ */
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_setZeroCopy
+  (JNIEnv *, jclass, jlong runner_, jboolean zeroCopy,
+   jboolean copyWhenExhausted)
+{
+    CameraRunner *runner = reinterpret_cast<CameraRunner *>(runner_);
+    if (!runner) {
+        return false;
+    }
+
+    return runner->setZeroCopy(zeroCopy, copyWhenExhausted
+                                             ? LeaseExhaustion::Copy
+                                             : LeaseExhaustion::DropFrames);
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    getLeasesOutstanding
+ * Signature: (J)I
+ */
+JNIEXPORT jint JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_getLeasesOutstanding
+  (JNIEnv *, jclass, jlong runner_)
+{
+    CameraRunner *runner = reinterpret_cast<CameraRunner *>(runner_);
+    if (!runner) {
+        return -1;
+    }
+
+    return runner->leasesOutstanding();
+}
+
 /*
  * Class:     org_photonvision_raspi_LibCameraJNI
  * Method:    getLibcameraTimestamp
@@ -368,6 +820,111 @@ Java_org_photonvision_raspi_LibCameraJNI_getLibcameraTimestamp
     return (jlong)now_nsec;
 }
 
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    getPipelineStats
+ * Signature: (J)[J
+ */
+JNIEXPORT jlongArray JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_getPipelineStats
+  (JNIEnv *env, jclass, jlong runner_)
+{
+    CameraRunner *runner = reinterpret_cast<CameraRunner *>(runner_);
+    if (!runner) {
+        return nullptr;
+    }
+
+    std::vector<int64_t> stats = runner->stats().flatten();
+
+    jlongArray ret = env->NewLongArray(stats.size());
+    if (!ret) {
+        return nullptr;
+    }
+    env->SetLongArrayRegion(ret, 0, stats.size(),
+                            reinterpret_cast<const jlong *>(stats.data()));
+    return ret;
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    startRecording
+ * Signature: (JLjava/lang/String;I)Z
+ */
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_startRecording
+  (JNIEnv *env, jclass, jlong runner_, jstring path, jint maxFrames)
+{
+    CameraRunner *runner = reinterpret_cast<CameraRunner *>(runner_);
+    if (!runner || maxFrames <= 0) {
+        return false;
+    }
+
+    const char *c_path = env->GetStringUTFChars(path, 0);
+
+    bool ok = true;
+    try {
+        runner->startRecording(c_path, maxFrames);
+    } catch (const std::runtime_error &e) {
+        std::printf("Failed to record to %s: %s\n", c_path, e.what());
+        ok = false;
+    }
+
+    env->ReleaseStringUTFChars(path, c_path);
+
+    return ok;
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    stopRecording
+ * Signature: (J)J
+ */
+JNIEXPORT jlong JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_stopRecording
+  (JNIEnv *, jclass, jlong runner_)
+{
+    CameraRunner *runner = reinterpret_cast<CameraRunner *>(runner_);
+    if (!runner) {
+        return -1;
+    }
+
+    return runner->stopRecording();
+}
+
+// MatPair holders handed to Java come back through releasePair, so keep a
+// few around instead of allocating one per frame. The Mats in a returned
+// holder are cleared first, which gives their buffers back to the pools.
+static std::mutex pairPoolMutex;
+static std::vector<std::unique_ptr<MatPair>> freePairs;
+static constexpr size_t MAX_FREE_PAIRS = 16;
+
+static MatPair *newPair(MatPair &&from) {
+    std::unique_ptr<MatPair> pair;
+    {
+        std::lock_guard<std::mutex> lock{pairPoolMutex};
+        if (!freePairs.empty()) {
+            pair = std::move(freePairs.back());
+            freePairs.pop_back();
+        }
+    }
+    if (!pair) {
+        return new MatPair(std::move(from));
+    }
+    *pair = std::move(from);
+    return pair.release();
+}
+
+static void recyclePair(MatPair *pair) {
+    std::unique_ptr<MatPair> owned{pair};
+    *owned = MatPair();
+
+    std::lock_guard<std::mutex> lock{pairPoolMutex};
+    if (freePairs.size() < MAX_FREE_PAIRS) {
+        freePairs.reserve(MAX_FREE_PAIRS);
+        freePairs.push_back(std::move(owned));
+    }
+}
+
 /*
  * Class:     org_photonvision_raspi_LibCameraJNI
  * Method:    awaitNewFrame
@@ -386,9 +943,7 @@ Java_org_photonvision_raspi_LibCameraJNI_awaitNewFrame
     // frame.
     std::optional<MatPair> mat = runner->outgoing.take(std::chrono::seconds(1));
     if (mat.has_value()) {
-        MatPair *pair = new MatPair;
-        *pair = mat.value();
-        return reinterpret_cast<jlong>(pair);
+        return reinterpret_cast<jlong>(newPair(std::move(mat.value())));
     }
     return 0;
 }
@@ -410,6 +965,23 @@ Java_org_photonvision_raspi_LibCameraJNI_takeColorFrame
     return reinterpret_cast<jlong>(new cv::Mat(std::move(pair->color)));
 }
 
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    takeFullResFrame
+ * Signature: (J)J
+ */
+JNIEXPORT jlong JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_takeFullResFrame
+  (JNIEnv *, jclass, jlong pair_)
+{
+    MatPair *pair = reinterpret_cast<MatPair *>(pair_);
+    if (!pair) {
+        return 0;
+    }
+
+    return reinterpret_cast<jlong>(new cv::Mat(std::move(pair->fullRes)));
+}
+
 /*
  * Class:     org_photonvision_raspi_LibCameraJNI
  * Method:    takeProcessedFrame
@@ -427,6 +999,25 @@ Java_org_photonvision_raspi_LibCameraJNI_takeProcessedFrame
     return reinterpret_cast<jlong>(new cv::Mat(std::move(pair->processed)));
 }
 
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    takeProcessedPlane
+ * Signature: (JI)J
+ */
+JNIEXPORT jlong JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_takeProcessedPlane
+  (JNIEnv *, jclass, jlong pair_, jint plane)
+{
+    MatPair *pair = reinterpret_cast<MatPair *>(pair_);
+    if (!pair || plane < 0 ||
+        plane >= static_cast<jint>(pair->processedPlanes.size())) {
+        return 0;
+    }
+
+    return reinterpret_cast<jlong>(
+        new cv::Mat(std::move(pair->processedPlanes[plane])));
+}
+
 /*
  * Class:     org_photonvision_raspi_LibCameraJNI
  * Method:    getFrameCaptureTime
@@ -477,7 +1068,7 @@ Java_org_photonvision_raspi_LibCameraJNI_releasePair
         return false;
     }
 
-    delete pair;
+    recyclePair(pair);
     return true;
 }
 
@@ -517,4 +1108,149 @@ Java_org_photonvision_raspi_LibCameraJNI_getGpuProcessType
     return pair->frameProcessingType;
 }
 
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    createCameraGroup
+ * Signature: ([JJ)J
+ */
+JNIEXPORT jlong JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_createCameraGroup
+  (JNIEnv *env, jclass, jlongArray runners_, jlong toleranceUs)
+{
+    if (!runners_) {
+        return 0;
+    }
+
+    std::vector<jlong> pointers(env->GetArrayLength(runners_));
+    env->GetLongArrayRegion(runners_, 0, pointers.size(), pointers.data());
+
+    std::vector<CameraRunner *> runners;
+    for (auto pointer : pointers) {
+        if (!pointer) {
+            return 0;
+        }
+        runners.push_back(reinterpret_cast<CameraRunner *>(pointer));
+    }
+
+    try {
+        return reinterpret_cast<jlong>(
+            new CameraGroup(std::move(runners), toleranceUs * 1000));
+    } catch (const std::runtime_error &e) {
+        std::printf("Failed to create camera group: %s\n", e.what());
+        return 0;
+    }
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    startCameraGroup
+ * Signature: (J)Z
+ */
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_startCameraGroup
+  (JNIEnv *, jclass, jlong group_)
+{
+    CameraGroup *group = reinterpret_cast<CameraGroup *>(group_);
+    if (!group) {
+        return false;
+    }
+
+    return group->start();
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    stopCameraGroup
+ * Signature: (J)Z
+ */
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_stopCameraGroup
+  (JNIEnv *, jclass, jlong group_)
+{
+    CameraGroup *group = reinterpret_cast<CameraGroup *>(group_);
+    if (!group) {
+        return false;
+    }
+
+    group->stop();
+    return true;
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    destroyCameraGroup
+ * Signature: (J)Z
+ */
+JNIEXPORT jboolean JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_destroyCameraGroup
+  (JNIEnv *, jclass, jlong group_)
+{
+    CameraGroup *group = reinterpret_cast<CameraGroup *>(group_);
+    if (!group) {
+        return false;
+    }
+
+    delete group;
+    return true;
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    awaitFrameSet
+ * Signature: (J)[J
+ */
+JNIEXPORT jlongArray JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_awaitFrameSet
+  (JNIEnv *env, jclass, jlong group_)
+{
+    CameraGroup *group = reinterpret_cast<CameraGroup *>(group_);
+    if (!group) {
+        return nullptr;
+    }
+
+    // Same timeout as awaitNewFrame
+    std::optional<FrameSet> set = group->outgoing.take(std::chrono::seconds(1));
+    if (!set) {
+        return nullptr;
+    }
+
+    jlongArray ret = env->NewLongArray(set->frames.size());
+    if (!ret) {
+        return nullptr;
+    }
+
+    // Each pair is freed by Java, with releasePair
+    std::vector<jlong> pairs;
+    for (auto &frame : set->frames) {
+        pairs.push_back(reinterpret_cast<jlong>(newPair(std::move(frame))));
+    }
+    env->SetLongArrayRegion(ret, 0, pairs.size(), pairs.data());
+    return ret;
+}
+
+/*
+ * Class:     org_photonvision_raspi_LibCameraJNI
+ * Method:    getCameraGroupStats
+ * Signature: (J)[J
+ */
+JNIEXPORT jlongArray JNICALL
+Java_org_photonvision_raspi_LibCameraJNI_getCameraGroupStats
+  (JNIEnv *env, jclass, jlong group_)
+{
+    CameraGroup *group = reinterpret_cast<CameraGroup *>(group_);
+    if (!group) {
+        return nullptr;
+    }
+
+    std::vector<int64_t> stats = group->stats().flatten();
+
+    jlongArray ret = env->NewLongArray(stats.size());
+    if (!ret) {
+        return nullptr;
+    }
+    env->SetLongArrayRegion(ret, 0, stats.size(),
+                            reinterpret_cast<const jlong *>(stats.data()));
+    return ret;
+}
+
 } // extern "C"
@@ -67,6 +67,15 @@ public class LibCameraJNI {
 
     private static native boolean isLibraryWorking();
 
+    /**
+     * Sets where compiled shaders are cached between runs, so cameras start faster after the first
+     * run. Defaults to $PHOTON_SHADER_CACHE, or a directory under ~/.cache. Takes effect for
+     * cameras created after every existing camera has been destroyed.
+     *
+     * @param directory Cache directory, created if needed, or "" to not cache shaders
+     */
+    public static native boolean setShaderCacheDirectory(String directory);
+
     public static native int getSensorModelRaw(long r_ptr);
 
     public static native int getSensorModelRaw(String name);
@@ -84,6 +93,238 @@ public class LibCameraJNI {
      */
     public static native long createCamera(String name, int width, int height, int rotation);
 
+    /** How deeply a runner buffers frames. See createCamera(String, int, int, int, Buffering). */
+    public static class Buffering {
+        /** Minimal buffering, always processing the freshest frame. */
+        public static final Buffering LATENCY_FIRST = new Buffering(2, 2, true);
+
+        /** Deeper pipelining, so bursts from a slow consumer don't drop frames. */
+        public static final Buffering THROUGHPUT_FIRST = new Buffering(6, 5, false);
+
+        /** Camera buffers libcamera cycles through, or 0 for libcamera's default. At most 16. */
+        public final int cameraBufferCount;
+
+        /** Buffers the GPU renders into; frames are dropped when all are busy. 1 to 16. */
+        public final int outputBufferCount;
+
+        /** When several camera frames are waiting, skip straight to the newest. */
+        public final boolean dropStaleFrames;
+
+        public Buffering(int cameraBufferCount, int outputBufferCount, boolean dropStaleFrames) {
+            this.cameraBufferCount = cameraBufferCount;
+            this.outputBufferCount = outputBufferCount;
+            this.dropStaleFrames = dropStaleFrames;
+        }
+    }
+
+    /**
+     * Creates a new runner like createCamera(String, int, int, int), with control over how deeply
+     * frames are buffered.
+     *
+     * @return the runner pointer for the camera, or 0 if the camera couldn't be found or the
+     *     buffer counts are out of range.
+     */
+    public static long createCamera(
+            String name, int width, int height, int rotation, Buffering buffering) {
+        return createCamera(name, width, height, rotation, buffering, null);
+    }
+
+    /**
+     * Creates a new runner like createCamera(String, int, int, int, Buffering), reading the sensor
+     * out in a specific mode rather than letting libcamera pick one.
+     *
+     * @param sensorMode One of the modes from getSensorModes, or null to let libcamera choose
+     * @return the runner pointer for the camera, or 0 if the camera couldn't be found, the buffer
+     *     counts are out of range, or the sensor mode isn't supported.
+     */
+    public static long createCamera(
+            String name,
+            int width,
+            int height,
+            int rotation,
+            Buffering buffering,
+            SensorMode sensorMode) {
+        return createCamera(name, width, height, rotation, buffering, sensorMode, 0, 0);
+    }
+
+    /**
+     * Creates a new runner like createCamera(String, int, int, int, Buffering, SensorMode), that
+     * thresholds a second, smaller stream scaled down by the ISP. Frames at the full width x height
+     * are only copied out when asked for with setCopyFullRes, and are taken with takeFullResFrame.
+     *
+     * @param processWidth Width to threshold at, no larger than width, or 0 to process frames at the
+     *     full size
+     * @param processHeight Height to threshold at, no larger than height, or 0 to process frames at
+     *     the full size
+     * @return the runner pointer for the camera, or 0 if it couldn't be created.
+     */
+    public static long createCamera(
+            String name,
+            int width,
+            int height,
+            int rotation,
+            Buffering buffering,
+            SensorMode sensorMode,
+            int processWidth,
+            int processHeight) {
+        return createCamera(
+                name,
+                width,
+                height,
+                rotation,
+                buffering,
+                sensorMode,
+                processWidth,
+                processHeight,
+                OutputFormat.COLOR_AND_PROCESSED);
+    }
+
+    /** What each frame from a runner holds. */
+    public enum OutputFormat {
+        /** BGR color (gray from a grayscale sensor), and the processed result. */
+        COLOR_AND_PROCESSED,
+        /** Only the processed frame. */
+        PROCESSED_ONLY,
+        /** Only a gray (CV_8UC1) color frame, straight from the camera without using the GPU. */
+        GRAY,
+        /** Only a BGR color frame. */
+        BGR,
+        /** Only a color frame, as BGRA (CV_8UC4) with the processed result as alpha. */
+        BGRA,
+        /** Only the camera's frame untouched, as I420 (CV_8UC1, height * 3/2 rows). */
+        YUV420
+    }
+
+    /**
+     * Creates a new runner like createCamera(String, int, int, int, Buffering, SensorMode, int,
+     * int), that only produces the frames in outputFormat. Formats with less in them move less
+     * memory per frame.
+     *
+     * @return the runner pointer for the camera, or 0 if it couldn't be created.
+     */
+    public static long createCamera(
+            String name,
+            int width,
+            int height,
+            int rotation,
+            Buffering buffering,
+            SensorMode sensorMode,
+            int processWidth,
+            int processHeight,
+            OutputFormat outputFormat) {
+        return createCameraWithOptions(
+                name,
+                width,
+                height,
+                rotation,
+                buffering.cameraBufferCount,
+                buffering.outputBufferCount,
+                buffering.dropStaleFrames,
+                sensorMode == null ? 0 : sensorMode.width,
+                sensorMode == null ? 0 : sensorMode.height,
+                sensorMode == null ? 0 : sensorMode.bitDepth,
+                processWidth,
+                processHeight,
+                outputFormat.ordinal());
+    }
+
+    private static native long createCameraWithOptions(
+            String name,
+            int width,
+            int height,
+            int rotation,
+            int cameraBufferCount,
+            int outputBufferCount,
+            boolean dropStaleFrames,
+            int sensorWidth,
+            int sensorHeight,
+            int sensorBitDepth,
+            int processWidth,
+            int processHeight,
+            int outputFormat);
+
+    /** One readout mode of a camera's sensor. */
+    public static class SensorMode {
+        public final int width;
+        public final int height;
+        public final int bitDepth;
+
+        /** Fastest frame rate the mode supports. */
+        public final double maxFps;
+
+        /** Region of the pixel array the mode covers, in full resolution pixels. */
+        public final int cropX, cropY, cropWidth, cropHeight;
+
+        public SensorMode(
+                int width,
+                int height,
+                int bitDepth,
+                double maxFps,
+                int cropX,
+                int cropY,
+                int cropWidth,
+                int cropHeight) {
+            this.width = width;
+            this.height = height;
+            this.bitDepth = bitDepth;
+            this.maxFps = maxFps;
+            this.cropX = cropX;
+            this.cropY = cropY;
+            this.cropWidth = cropWidth;
+            this.cropHeight = cropHeight;
+        }
+
+        @Override
+        public String toString() {
+            return String.format(
+                    "%dx%d %d-bit @ %.1f fps, crop (%d, %d) %dx%d",
+                    width, height, bitDepth, maxFps, cropX, cropY, cropWidth, cropHeight);
+        }
+    }
+
+    /**
+     * Lists the readout modes of a camera's sensor. The camera must not be in use by a runner.
+     *
+     * @param name the path / name of the camera as given from libcamera.
+     * @return the modes, or null if the camera couldn't be queried, including when it is already in
+     *     use. An empty array means the sensor reported no modes.
+     */
+    public static SensorMode[] getSensorModes(String name) {
+        double[] flat = getSensorModesRaw(name);
+        if (flat == null) {
+            return null;
+        }
+
+        SensorMode[] modes = new SensorMode[flat.length / 8];
+        for (int i = 0; i < modes.length; i++) {
+            int o = i * 8;
+            modes[i] =
+                    new SensorMode(
+                            (int) flat[o],
+                            (int) flat[o + 1],
+                            (int) flat[o + 2],
+                            flat[o + 3],
+                            (int) flat[o + 4],
+                            (int) flat[o + 5],
+                            (int) flat[o + 6],
+                            (int) flat[o + 7]);
+        }
+        return modes;
+    }
+
+    private static native double[] getSensorModesRaw(String name);
+
+    /**
+     * Creates a new runner that plays back a capture file instead of reading from a camera. The
+     * returned runner is used exactly like one from createCamera.
+     *
+     * @param path Capture file to replay
+     * @param fps Frames per second to replay at, or 0 to replay as fast as frames are consumed
+     * @param loop Whether to start over at the end of the file
+     * @return the runner pointer, or 0 if the file couldn't be opened.
+     */
+    public static native long createReplayCamera(String path, double fps, boolean loop);
+
     /**
      * Starts the camera thresholder and display threads running. Make sure that this function is
      * called synchronously with stopCamera and returnFrame!
@@ -109,6 +350,38 @@ public class LibCameraJNI {
             double vu,
             boolean hueInverted);
 
+    /**
+     * Set one of the HSV ranges the multi or HSV ranges process types mask with, on [0..1]. Range 0
+     * is the one setThresholds sets.
+     *
+     * @param range Which range, from 0 to 7
+     * @return false if there's no such range
+     */
+    public static native boolean setHsvRange(
+            long r_ptr,
+            int range,
+            double hl,
+            double sl,
+            double vl,
+            double hu,
+            double su,
+            double vu,
+            boolean hueInverted);
+
+    /**
+     * Replace the HSV ranges the HSV ranges process type checks, up to 8 of them. They're all
+     * checked in one pass, and the processed mat says which a pixel is in.
+     *
+     * @param thresholds hl, sl, vl, hu, su, vu for each range, on [0..1]
+     * @param hueInverted Whether each range's hue is inverted, as in setThresholds
+     * @param labels What each range marks pixels with, on [1..255], when not bitmask
+     * @param bitmask If true, range i sets bit i of the processed mat. If false, pixels get the
+     *     label of the first range they're in, or 0.
+     * @return false if the arrays don't match up, or there are too many ranges
+     */
+    public static native boolean setHsvRanges(
+            long r_ptr, double[] thresholds, boolean[] hueInverted, int[] labels, boolean bitmask);
+
     public static native boolean setAutoExposure(long r_ptr, boolean doAutoExposure);
 
     // Exposure time, in microseconds
@@ -123,6 +396,46 @@ public class LibCameraJNI {
     // Unknown ranges for red and blue AWB gain
     public static native boolean setAwbGain(long r_ptr, double red, double blue);
 
+    /**
+     * Set every camera setting at once. Unlike calling the individual setters, the new settings are
+     * applied together, starting with the very next frame the camera is asked for.
+     *
+     * @param exposureUs Exposure time in microseconds, ignored while doAutoExposure is set
+     * @param analog Analog gain, on [1, Big Number]
+     * @param brightness Brightness on [-1, 1]
+     * @param contrast Contrast, nominally 1
+     * @param red Red AWB gain
+     * @param blue Blue AWB gain
+     * @param saturation Saturation, nominally 1
+     */
+    public static native boolean setCameraSettings(
+            long r_ptr,
+            boolean doAutoExposure,
+            int exposureUs,
+            double analog,
+            double brightness,
+            double contrast,
+            double red,
+            double blue,
+            double saturation);
+
+    /**
+     * Bounds how long each frame may take, which bounds the frame rate. Passing equal values locks
+     * the frame rate; otherwise it slows down as exposure gets longer. Defaults to 1/120 s to 1 s.
+     *
+     * @param minUs Shortest frame duration in microseconds, i.e. 1e6 / max fps
+     * @param maxUs Longest frame duration in microseconds, i.e. 1e6 / min fps
+     * @return false if the range is empty or entirely outside what the camera supports. Ranges
+     *     that partly overlap are clamped to the camera's limits.
+     */
+    public static native boolean setFrameDurationLimits(long r_ptr, long minUs, long maxUs);
+
+    /**
+     * @return the shortest and longest frame durations in microseconds the camera supports in its
+     *     current sensor mode, or null if its frame rate can't be controlled.
+     */
+    public static native long[] getFrameDurationLimits(long r_ptr);
+
     /**
      * Get the time when the first pixel exposure was started, in the same timebase as libcamera gives
      * the frame capture time. Units are nanoseconds.
@@ -143,8 +456,103 @@ public class LibCameraJNI {
      */
     public static native long getLibcameraTimestamp();
 
+    /** Number of pipeline stages reported by getPipelineStats. */
+    public static final int PIPELINE_STAGE_COUNT = 7;
+
+    /** Number of longs reported per stage by getPipelineStats. */
+    public static final int PIPELINE_STAGE_FIELDS = 5;
+
+    /**
+     * Get a snapshot of per-stage latency histograms and drop counters for a runner. These are
+     * reset each time the camera is started.
+     *
+     * <p>The stages, in order, are: capture (sensor timestamp to libcamera completing the request),
+     * camera queue (waiting for the GPU thread), GPU submit, GPU render (submitted until the
+     * display thread sees the render finish), copy, publish (handing the frame to awaitNewFrame),
+     * and total (sensor timestamp to published). Each stage is reported as [count, p50, p90, p99,
+     * max], in microseconds. These are followed by six counters: frames published, frames the
+     * sensor produced that we never received, frames dropped because no GPU output buffer was free,
+     * frames replaced before awaitNewFrame took them, frames skipped because a newer one was
+     * already waiting, and frames thrown away after rendering or copying because the display
+     * thread had fallen behind. Only the third is helped by more output buffers in RunnerOptions.
+     *
+     * @return PIPELINE_STAGE_COUNT * PIPELINE_STAGE_FIELDS + 6 longs, or null if r_ptr is null
+     */
+    public static native long[] getPipelineStats(long r_ptr);
+
+    /**
+     * Start recording every frame the camera produces, with its metadata, to a capture file that
+     * can later be played back with createReplayCamera. Frames are written from a background
+     * thread; if it falls behind, frames are left out of the recording rather than slowing down
+     * the pipeline. Replaces any recording already in progress.
+     *
+     * @param path File to write. Space for maxFrames frames is reserved up front.
+     * @param maxFrames Maximum number of frames to record
+     * @return false if the file couldn't be created
+     */
+    public static native boolean startRecording(long r_ptr, String path, int maxFrames);
+
+    /**
+     * Finish writing the current recording.
+     *
+     * @return the number of frames recorded, or -1 if we weren't recording
+     */
+    public static native long stopRecording(long r_ptr);
+
     public static native long setFramesToCopy(long r_ptr, boolean copyIn, boolean copyOut);
 
+    /**
+     * Captures only part of the sensor, scaled up to the same output size, to put more pixels on a
+     * target. The crop can change every frame; getFrameScalerCrop reports the one actually used.
+     *
+     * @param x Left edge, in the coordinates given by getScalerCropMaximum
+     * @param y Top edge
+     * @param width Width of the region, or 0 to capture the whole field of view again
+     * @param height Height of the region, or 0 to capture the whole field of view again
+     * @param keepAspect Grow the region to the output's aspect ratio, so the image is zoomed in
+     *     rather than stretched
+     * @return false if the camera can't crop.
+     */
+    public static native boolean setRegionOfInterest(
+            long r_ptr, int x, int y, int width, int height, boolean keepAspect);
+
+    /**
+     * @return the region covering the whole field of view as {x, y, width, height}, which region
+     *     of interest coordinates are relative to, or null if the camera can't crop.
+     */
+    public static native int[] getScalerCropMaximum(long r_ptr);
+
+    /**
+     * Get the part of the sensor a frame was scaled from, as {x, y, width, height}, for mapping
+     * image coordinates back onto the sensor. All 0 if unknown. Call before releasePair.
+     */
+    public static native int[] getFrameScalerCrop(long pair_ptr);
+
+    /**
+     * Sets whether to copy out each frame at the full resolution, for runners created with a
+     * smaller processing size. Off by default.
+     */
+    public static native boolean setCopyFullRes(long r_ptr, boolean copyFullRes);
+
+    /**
+     * Sets whether frames the GPU renders are handed out without being copied. The mats then view
+     * the GPU's output buffer, which isn't rendered into again until both they and the pair are
+     * released, so release them promptly. Only offered where the mats have the same types as
+     * copied ones: single channel output, which becomes the processed mat, and the BGRA output
+     * format, which becomes the color mat. Off by default.
+     *
+     * @param copyWhenExhausted When leaving a frame out would leave the GPU nowhere to render,
+     *     copy it as usual if true, or keep leasing and let the GPU drop frames if false
+     * @return false if zero-copy was asked for with an output format whose copied mats can't view
+     *     the rendered buffer (color plus processed from a color sensor, or BGR), in which case
+     *     frames are still copied
+     */
+    public static native boolean setZeroCopy(
+            long r_ptr, boolean zeroCopy, boolean copyWhenExhausted);
+
+    /** @return how many of the GPU's output buffers zero-copy frames are holding, or -1 */
+    public static native int getLeasesOutstanding(long r_ptr);
+
     // Analog gain multiplier to apply to all color channels, on [1, Big Number]
     public static native boolean setAnalogGain(long r_ptr, double analog);
 
@@ -153,18 +561,37 @@ public class LibCameraJNI {
 
     /**
      * Get a pointer to the most recent color mat generated. Call this immediately after
-     * awaitNewFrame, and call only once per new frame!
+     * awaitNewFrame, and call only once per new frame! This is BGR, except from grayscale sensors
+     * (such as the OV9281), where it's a single channel of gray, or as chosen by the runner's
+     * OutputFormat. Empty if the format has no color frame.
      */
     public static native long takeColorFrame(long pair_ptr);
 
     /**
      * Get a pointer to the most recent processed mat generated. Call this immediately after
-     * awaitNewFrame, and call only once per new frame!
+     * awaitNewFrame, and call only once per new frame! Empty if the runner's OutputFormat has no
+     * processed frame. For the multi process type, this is the adaptive threshold.
      */
     public static native long takeProcessedFrame(long pair_ptr);
 
     /**
-     * Set the GPU processing type we should do. Enum of [none, HSV, greyscale, adaptive threshold].
+     * Get a pointer to one of the multi process type's other results: 0 for HSV range 0's mask, 1
+     * for HSV range 1's mask, or 2 for gray. Empty for every other process type. Call only once
+     * per plane per new frame!
+     */
+    public static native long takeProcessedPlane(long pair_ptr, int plane);
+
+    /**
+     * Get a pointer to the most recent full resolution mat, as I420 (a single channel, height * 3/2
+     * rows tall). The mat is empty unless setCopyFullRes is on. Call this immediately after
+     * awaitNewFrame, and call only once per new frame!
+     */
+    public static native long takeFullResFrame(long pair_ptr);
+
+    /**
+     * Set the GPU processing type we should do. Enum of [none, HSV, greyscale, adaptive threshold,
+     * multi, HSV ranges]. Multi does two HSV ranges, greyscale and adaptive threshold in one pass;
+     * see takeProcessedPlane. HSV ranges is set up by setHsvRanges.
      */
     public static native boolean setGpuProcessType(long r_ptr, int type);
 
@@ -178,4 +605,40 @@ public class LibCameraJNI {
 
     /** Get an array containing the names/ids/paths of all connected CSI cameras from libcamera. @return All connected CSI cameras' paths */
     public static native String[] getCameraNames();
+
+    // ======================================================== //
+
+    /**
+     * Groups several runners so their frames are delivered in sets, one frame per camera, captured
+     * within toleranceUs of each other. The cameras aren't triggered together, so they should run
+     * at the same fixed frame rate (see setFrameDurationLimits). Once grouped, frames must be taken
+     * with awaitFrameSet rather than awaitNewFrame, and the runners must be started and stopped
+     * through the group. The group doesn't own the runners; destroy it before them.
+     *
+     * @param r_ptrs Runner pointers from createCamera
+     * @param toleranceUs Largest difference in capture time allowed within a set
+     * @return the group pointer, or 0 on failure.
+     */
+    public static native long createCameraGroup(long[] r_ptrs, long toleranceUs);
+
+    public static native boolean startCameraGroup(long g_ptr);
+
+    public static native boolean stopCameraGroup(long g_ptr);
+
+    public static native boolean destroyCameraGroup(long g_ptr);
+
+    /**
+     * Block until the next matched set of frames is available, or a second passes.
+     *
+     * @return one pair pointer per runner, in the order given to createCameraGroup, or null if no
+     *     set was ready. Each pair is used like one from awaitNewFrame, and freed with releasePair.
+     */
+    public static native long[] awaitFrameSet(long g_ptr);
+
+    /**
+     * Matching stats since the group was started: count, p50, p90, p99 and max of the skew within
+     * each set in microseconds, followed by sets published, frames dropped for having no match,
+     * and sets replaced before being taken.
+     */
+    public static native long[] getCameraGroupStats(long g_ptr);
 }
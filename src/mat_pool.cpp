@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "mat_pool.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+static constexpr size_t BUFFER_ALIGNMENT = 64;
+
+std::shared_ptr<MatPool> MatPool::make(size_t bufferSize, int count) {
+    return std::shared_ptr<MatPool>(new MatPool(bufferSize, count));
+}
+
+MatPool::MatPool(size_t bufferSize, int count)
+    : m_bufferSize((bufferSize + BUFFER_ALIGNMENT - 1) / BUFFER_ALIGNMENT *
+                   BUFFER_ALIGNMENT),
+      m_headers(count) {
+    m_buffers = static_cast<uint8_t *>(
+        std::aligned_alloc(BUFFER_ALIGNMENT, m_bufferSize * count));
+    if (!m_buffers) {
+        throw std::runtime_error("failed to allocate mat pool");
+    }
+    // Fault every page in now rather than on the first frames
+    std::memset(m_buffers, 0, m_bufferSize * count);
+
+    m_free.reserve(count);
+    for (int i = count - 1; i >= 0; i--) {
+        m_free.push_back(i);
+    }
+}
+
+MatPool::~MatPool() { std::free(m_buffers); }
+
+cv::Mat MatPool::mat(int rows, int cols, int type) {
+    cv::Mat mat;
+    mat.allocator = this;
+    mat.create(rows, cols, type);
+    // The buffer remembers where to go back to through its UMatData. Don't
+    // leave the header pointing at us too, or a later create() on a Mat that
+    // outlived the pool would allocate from a dangling allocator.
+    mat.allocator = nullptr;
+    return mat;
+}
+
+cv::UMatData *MatPool::allocate(int dims, const int *sizes, int type,
+                                void *data, size_t *step, cv::AccessFlag flags,
+                                cv::UMatUsageFlags usageFlags) const {
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = 0; i < dims; i++) {
+        total *= sizes[i];
+    }
+
+    int idx = -1;
+    if (!data && total <= m_bufferSize) {
+        std::lock_guard lock{m_mutex};
+        if (!m_free.empty()) {
+            idx = m_free.back();
+            m_free.pop_back();
+            if (!m_keepAlive) {
+                m_keepAlive = shared_from_this();
+            }
+        }
+    }
+
+    if (idx < 0) {
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data,
+                                                    step, flags, usageFlags);
+    }
+
+    if (step) {
+        size_t stride = CV_ELEM_SIZE(type);
+        for (int i = dims - 1; i >= 0; i--) {
+            step[i] = stride;
+            stride *= sizes[i];
+        }
+    }
+
+    auto u = new (m_headers[idx].storage) cv::UMatData(this);
+    u->data = u->origdata = m_buffers + idx * m_bufferSize;
+    u->size = total;
+    return u;
+}
+
+bool MatPool::allocate(cv::UMatData *data, cv::AccessFlag,
+                       cv::UMatUsageFlags) const {
+    return data != nullptr;
+}
+
+void MatPool::deallocate(cv::UMatData *u) const {
+    if (!u) {
+        return;
+    }
+
+    int idx = static_cast<int>((u->origdata - m_buffers) / m_bufferSize);
+    u->~UMatData();
+
+    // Moved out so that, if this was the last buffer out after our owner let
+    // go of us, we get destroyed after the lock is released
+    std::shared_ptr<const MatPool> keepAlive;
+    {
+        std::lock_guard lock{m_mutex};
+        m_free.push_back(idx);
+        if (m_free.size() == m_headers.size()) {
+            keepAlive = std::move(m_keepAlive);
+        }
+    }
+}
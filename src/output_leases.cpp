@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "output_leases.h"
+
+#include <linux/dma-buf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#include "dma_buf_alloc.h"
+
+std::shared_ptr<OutputLeases> OutputLeases::make(const std::vector<int> &fds,
+                                                 size_t size) {
+    return std::shared_ptr<OutputLeases>(new OutputLeases(fds, size));
+}
+
+OutputLeases::OutputLeases(const std::vector<int> &fds, size_t size)
+    : m_fds(fds), m_size(size), m_headers(fds.size()),
+      m_leased(fds.size(), false) {
+    auto cleanup = [&] {
+        for (uint8_t *mapping : m_mappings) {
+            munmap(mapping, size);
+        }
+        for (int fd : m_ownFds) {
+            close(fd);
+        }
+    };
+
+    for (int fd : fds) {
+        int own = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (own < 0) {
+            cleanup();
+            throw std::runtime_error("failed to dup output buffer");
+        }
+        m_ownFds.push_back(own);
+
+        // Writable, since nothing stops whoever holds a lease from writing
+        // through it
+        void *ptr =
+            mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, own, 0);
+        if (ptr == MAP_FAILED) {
+            cleanup();
+            throw std::runtime_error("failed to mmap output buffer");
+        }
+        m_mappings.push_back(static_cast<uint8_t *>(ptr));
+    }
+}
+
+OutputLeases::~OutputLeases() {
+    for (uint8_t *mapping : m_mappings) {
+        munmap(mapping, m_size);
+    }
+    for (int fd : m_ownFds) {
+        close(fd);
+    }
+}
+
+int OutputLeases::index(int fd) const {
+    auto it = std::find(m_fds.begin(), m_fds.end(), fd);
+    if (it == m_fds.end()) {
+        throw std::runtime_error("not one of our output buffers");
+    }
+    return static_cast<int>(it - m_fds.begin());
+}
+
+uint8_t *OutputLeases::data(int fd) const { return m_mappings[index(fd)]; }
+
+cv::Mat OutputLeases::lease(int fd, int rows, int cols, int type) {
+    int idx = index(fd);
+    size_t total = static_cast<size_t>(rows) * cols * CV_ELEM_SIZE(type);
+    if (total > m_size) {
+        throw std::runtime_error("lease larger than the output buffer");
+    }
+
+    // Ended when the lease comes back, in deallocate
+    syncDmaBuf(m_ownFds[idx], DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW);
+
+    {
+        std::lock_guard lock{m_mutex};
+        if (m_leased[idx]) {
+            throw std::runtime_error("output buffer leased twice");
+        }
+        m_leased[idx] = true;
+        m_outstanding++;
+        if (!m_keepAlive) {
+            m_keepAlive = shared_from_this();
+        }
+    }
+
+    cv::Mat mat(rows, cols, type, m_mappings[idx]);
+    auto u = new (m_headers[idx].storage) cv::UMatData(this);
+    u->data = u->origdata = m_mappings[idx];
+    u->size = total;
+    u->refcount = 1;
+    mat.u = u;
+    return mat;
+}
+
+int OutputLeases::outstanding() const {
+    std::lock_guard lock{m_mutex};
+    return m_outstanding;
+}
+
+void OutputLeases::attach(
+    std::function<void(int)> onReturn,
+    const std::function<void(const std::vector<int> &)> &start) {
+    std::lock_guard lock{m_mutex};
+    std::vector<int> leased;
+    for (size_t i = 0; i < m_fds.size(); i++) {
+        if (m_leased[i]) {
+            leased.push_back(m_fds[i]);
+        }
+    }
+    start(leased);
+    m_onReturn = std::move(onReturn);
+}
+
+void OutputLeases::detach() {
+    std::lock_guard lock{m_mutex};
+    m_onReturn = nullptr;
+}
+
+cv::UMatData *OutputLeases::allocate(int dims, const int *sizes, int type,
+                                     void *data, size_t *step,
+                                     cv::AccessFlag flags,
+                                     cv::UMatUsageFlags usageFlags) const {
+    // Leases are made by lease(), never by Mat::create
+    return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step,
+                                                flags, usageFlags);
+}
+
+bool OutputLeases::allocate(cv::UMatData *data, cv::AccessFlag,
+                            cv::UMatUsageFlags) const {
+    return data != nullptr;
+}
+
+void OutputLeases::deallocate(cv::UMatData *u) const {
+    if (!u) {
+        return;
+    }
+
+    int idx = static_cast<int>(
+        std::find(m_mappings.begin(), m_mappings.end(), u->origdata) -
+        m_mappings.begin());
+    u->~UMatData();
+
+    // Can't throw from here, and there'd be nothing to do about it anyway.
+    // Our own fd, as the runner may have closed its copy by now.
+    trySyncDmaBuf(m_ownFds[idx], DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW);
+
+    // Moved out so that, if this was the last lease out after our owner let
+    // go of us, we get destroyed after the lock is released
+    std::shared_ptr<const OutputLeases> keepAlive;
+    {
+        std::lock_guard lock{m_mutex};
+        m_leased[idx] = false;
+        m_outstanding--;
+        if (m_onReturn) {
+            m_onReturn(m_fds[idx]);
+        }
+        if (m_outstanding == 0) {
+            keepAlive = std::move(m_keepAlive);
+        }
+    }
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "program_cache.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <EGL/egl.h>
+#include <GLES2/gl2ext.h>
+
+// Written in front of every binary
+struct ProgramCacheHeader {
+    char magic[8];
+    uint64_t key;
+    uint64_t checksum; // of the binary that follows
+    uint32_t format;
+    uint32_t length;
+};
+
+static constexpr char PROGRAM_CACHE_MAGIC[8] = {'P', 'H', 'G', 'L',
+                                                'P', 'R', 'G', '1'};
+
+// FNV-1a
+static uint64_t hashBytes(const void *data, size_t size,
+                          uint64_t hash = 14695981039346656037ULL) {
+    const auto *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static std::string glString(GLenum name) {
+    const auto *value = glGetString(name);
+    return value ? reinterpret_cast<const char *>(value) : "";
+}
+
+// glGetError() reports the oldest error since it was last called, and with
+// GLERROR() compiled out nothing else calls it. Drain it before a call whose
+// error we check, so an earlier failure isn't blamed on that call.
+static void clearGlErrors() {
+    while (glGetError() != GL_NO_ERROR) {
+    }
+}
+
+ProgramCache::ProgramCache(std::string directory)
+    : m_directory(std::move(directory)) {}
+
+std::string ProgramCache::defaultDirectory() {
+    if (const char *dir = std::getenv("PHOTON_SHADER_CACHE")) {
+        return dir;
+    }
+    if (const char *dir = std::getenv("XDG_CACHE_HOME"); dir && *dir) {
+        return std::string(dir) + "/photonvision/shaders";
+    }
+    if (const char *home = std::getenv("HOME"); home && *home) {
+        return std::string(home) + "/.cache/photonvision/shaders";
+    }
+    return "";
+}
+
+bool ProgramCache::enabled() {
+    if (m_checked) {
+        return m_supported;
+    }
+    m_checked = true;
+
+    if (m_directory.empty()) {
+        return false;
+    }
+
+    GLint formats = 0;
+    clearGlErrors();
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+    if (glGetError() != GL_NO_ERROR ||
+        glString(GL_EXTENSIONS).find("GL_OES_get_program_binary") ==
+            std::string::npos ||
+        formats <= 0) {
+        std::printf("Program binaries not supported, not caching shaders\n");
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(m_directory, error);
+    if (error) {
+        std::printf("Failed to create shader cache %s: %s\n",
+                    m_directory.c_str(), error.message().c_str());
+        return false;
+    }
+
+    m_driver = glString(GL_VENDOR) + '\n' + glString(GL_RENDERER) + '\n' +
+               glString(GL_VERSION) + '\n';
+    m_supported = true;
+    return true;
+}
+
+uint64_t ProgramCache::key(const std::string &vertexSource,
+                           const std::string &fragmentSource) const {
+    uint64_t hash = hashBytes(m_driver.data(), m_driver.size());
+    hash = hashBytes(vertexSource.data(), vertexSource.size() + 1, hash);
+    return hashBytes(fragmentSource.data(), fragmentSource.size(), hash);
+}
+
+std::string ProgramCache::path(uint64_t key) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin",
+                  static_cast<unsigned long long>(key));
+    return m_directory + "/" + name;
+}
+
+GLuint ProgramCache::load(const std::string &vertexSource,
+                          const std::string &fragmentSource) {
+    static auto glProgramBinaryOES =
+        (PFNGLPROGRAMBINARYOESPROC)eglGetProcAddress("glProgramBinaryOES");
+    if (!enabled() || !glProgramBinaryOES) {
+        return 0;
+    }
+
+    uint64_t entryKey = key(vertexSource, fragmentSource);
+    std::string entryPath = path(entryKey);
+    std::ifstream file(entryPath, std::ios::binary);
+    if (!file) {
+        return 0;
+    }
+    std::vector<char> contents{std::istreambuf_iterator<char>(file),
+                               std::istreambuf_iterator<char>()};
+
+    ProgramCacheHeader header;
+    bool valid = contents.size() >= sizeof(header);
+    if (valid) {
+        std::memcpy(&header, contents.data(), sizeof(header));
+        const char *binary = contents.data() + sizeof(header);
+        valid = std::memcmp(header.magic, PROGRAM_CACHE_MAGIC,
+                            sizeof(header.magic)) == 0 &&
+                header.key == entryKey &&
+                header.length == contents.size() - sizeof(header) &&
+                header.checksum == hashBytes(binary, header.length);
+    }
+
+    GLuint program = 0;
+    if (valid) {
+        clearGlErrors();
+        program = glCreateProgram();
+        glProgramBinaryOES(program, header.format,
+                           contents.data() + sizeof(header), header.length);
+        GLint status = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        // The driver can reject a binary it wrote itself, e.g. after an
+        // update that didn't change its version string
+        if (glGetError() != GL_NO_ERROR || status != GL_TRUE) {
+            glDeleteProgram(program);
+            program = 0;
+        }
+    }
+
+    if (!program) {
+        std::printf("Discarding stale shader cache entry %s\n",
+                    entryPath.c_str());
+        std::remove(entryPath.c_str());
+    }
+    return program;
+}
+
+void ProgramCache::store(GLuint program, const std::string &vertexSource,
+                         const std::string &fragmentSource) {
+    static auto glGetProgramBinaryOES =
+        (PFNGLGETPROGRAMBINARYOESPROC)eglGetProcAddress(
+            "glGetProgramBinaryOES");
+    if (!enabled() || !glGetProgramBinaryOES) {
+        return;
+    }
+
+    GLint length = 0;
+    clearGlErrors();
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if (glGetError() != GL_NO_ERROR || length <= 0) {
+        return;
+    }
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    GLsizei written = 0;
+    clearGlErrors();
+    glGetProgramBinaryOES(program, length, &written, &format, binary.data());
+    if (glGetError() != GL_NO_ERROR || written <= 0) {
+        return;
+    }
+
+    ProgramCacheHeader header{};
+    std::memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+    header.key = key(vertexSource, fragmentSource);
+    header.checksum = hashBytes(binary.data(), written);
+    header.format = format;
+    header.length = written;
+
+    // Written aside and renamed into place, so a crash (or another process
+    // starting at the same time) never sees half an entry
+    std::string entryPath = path(header.key);
+    std::string tempPath =
+        entryPath + "." + std::to_string(getpid()) + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(binary.data(), written);
+        if (!file) {
+            std::remove(tempPath.c_str());
+            return;
+        }
+    }
+    if (std::rename(tempPath.c_str(), entryPath.c_str())) {
+        std::remove(tempPath.c_str());
+    }
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "replay_frame_source.h"
+
+#include <linux/dma-buf.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include "dma_buf_alloc.h"
+#include "pipeline_stats.h"
+
+ReplayFrameSource::ReplayFrameSource(const std::string &path, double fps,
+                                     bool loop, int bufferCount)
+    : m_reader(path), m_fps(fps), m_loop(loop) {
+    const auto &header = m_reader.header();
+    if (m_reader.frameCount() == 0) {
+        throw std::runtime_error("capture file has no frames");
+    }
+
+    std::printf("Replaying %u frames of %ux%u from %s\n",
+                m_reader.frameCount(), header.width, header.height,
+                path.c_str());
+
+    unsigned int stride = header.stride;
+    unsigned int ySize = stride * header.height;
+    unsigned int uvSize = ySize / 4;
+
+    auto alloc = makeAnyDmaBufAllocator();
+    for (int i = 0; i < bufferCount; i++) {
+        int fd = alloc(header.frameSize);
+        auto ptr = mmap(nullptr, header.frameSize, PROT_WRITE, MAP_SHARED, fd,
+                        0);
+        if (ptr == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("failed to mmap replay buffer");
+        }
+
+        m_mapped.push_back(static_cast<uint8_t *>(ptr));
+        m_buffers.push_back({{
+            {fd, 0, ySize, stride},
+            {fd, ySize, uvSize, stride / 2},
+            {fd, ySize + uvSize, uvSize, stride / 2},
+        }});
+    }
+}
+
+ReplayFrameSource::~ReplayFrameSource() {
+    stop();
+    for (size_t i = 0; i < m_buffers.size(); i++) {
+        munmap(m_mapped[i], m_reader.header().frameSize);
+        close(m_buffers[i][0].fd);
+    }
+}
+
+int ReplayFrameSource::width() const { return m_reader.header().width; }
+
+int ReplayFrameSource::height() const { return m_reader.header().height; }
+
+const std::vector<YuvBuffer> &ReplayFrameSource::buffers() const {
+    return m_buffers;
+}
+
+libcamera::ColorSpace ReplayFrameSource::colorSpace() const {
+    return captureColorSpace(m_reader.header());
+}
+
+CameraModel ReplayFrameSource::model() const {
+    return static_cast<CameraModel>(m_reader.header().model);
+}
+
+bool ReplayFrameSource::startAndQueue() {
+    {
+        std::lock_guard lock{m_mutex};
+        m_free = {};
+        for (size_t i = 0; i < m_buffers.size(); i++) {
+            m_free.push(i);
+        }
+        m_running = true;
+    }
+    m_thread = std::thread([this] { run(); });
+    return true;
+}
+
+void ReplayFrameSource::stop() {
+    {
+        std::lock_guard lock{m_mutex};
+        m_running = false;
+    }
+    m_cv.notify_one();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void ReplayFrameSource::requeue(const Frame &frame) {
+    {
+        std::lock_guard lock{m_mutex};
+        m_free.push(frame.bufferIndex);
+    }
+    m_cv.notify_one();
+}
+
+void ReplayFrameSource::run() {
+    // Anything thrown on this thread would terminate the process, so a failed
+    // read or sync ends the replay instead, like the end of a file that
+    // doesn't loop. stop() still joins the thread as usual.
+    try {
+        play();
+    } catch (const std::runtime_error &e) {
+        std::fprintf(stderr, "Replay stopped: %s\n", e.what());
+        std::lock_guard lock{m_mutex};
+        m_running = false;
+    }
+}
+
+void ReplayFrameSource::play() {
+    using clock = std::chrono::steady_clock;
+    const auto period = std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(m_fps > 0 ? 1 / m_fps : 0));
+    const uint32_t frameSize = m_reader.header().frameSize;
+
+    auto deadline = clock::now();
+    uint32_t next = 0;
+    uint32_t sequence = 0;
+
+    while (true) {
+        if (next == m_reader.frameCount()) {
+            if (!m_loop) {
+                break;
+            }
+            next = 0;
+        }
+
+        int bufferIndex;
+        {
+            std::unique_lock lock{m_mutex};
+            m_cv.wait(lock, [&] { return !m_running || !m_free.empty(); });
+            if (!m_running) {
+                break;
+            }
+            bufferIndex = m_free.front();
+            m_free.pop();
+        }
+
+        if (m_fps > 0) {
+            std::this_thread::sleep_until(deadline);
+            // Don't try to catch up if the pipeline fell behind
+            deadline = std::max(deadline + period, clock::now());
+        }
+
+        int fd = m_buffers[bufferIndex][0].fd;
+        syncDmaBuf(fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+        std::memcpy(m_mapped[bufferIndex], m_reader.frame(next), frameSize);
+        syncDmaBuf(fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+
+        // Timestamps are rebased to now, so latencies measured against them
+        // are meaningful. Sequence numbers keep counting across loops.
+        const auto &index = m_reader.index(next);
+        Frame frame{.bufferIndex = bufferIndex,
+                    .metadata = {
+                        .sensorTimestamp = static_cast<uint64_t>(bootTimeNs()),
+                        .exposureTimeUs = index.exposureTimeUs,
+                        .analogGain = index.analogGain,
+                        .sequence = sequence++,
+                        .scalerCrop = {},
+                    }};
+        next++;
+
+        if (m_onData) {
+            m_onData->operator()(frame);
+        } else {
+            requeue(frame);
+        }
+    }
+}
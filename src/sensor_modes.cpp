@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) Photon Vision.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "sensor_modes.h"
+
+#include <libcamera/control_ids.h>
+
+#include <map>
+#include <stdexcept>
+#include <string>
+
+// libcamera doesn't expose PixelFormatInfo publicly, so the Bayer and mono raw
+// formats are listed by name. Anything else, like the Pi 5's compressed
+// BGGR_PISP_COMP1, has no bit depth a SensorConfiguration would accept, and
+// gives 0.
+static unsigned int bitDepthOf(const libcamera::PixelFormat &format) {
+    static const std::map<std::string, unsigned int> depths = [] {
+        std::map<std::string, unsigned int> depths{
+            {"R8", 8},           {"R10", 10},         {"R12", 12},
+            {"R16", 16},         {"R10_CSI2P", 10},   {"R12_CSI2P", 12},
+        };
+        for (const char *order : {"BGGR", "GBRG", "GRBG", "RGGB"}) {
+            std::string name = std::string("S") + order;
+            depths[name + "8"] = 8;
+            depths[name + "16"] = 16;
+            for (unsigned int depth : {10, 12, 14}) {
+                depths[name + std::to_string(depth)] = depth;
+                depths[name + std::to_string(depth) + "_CSI2P"] = depth;
+            }
+        }
+        return depths;
+    }();
+
+    auto it = depths.find(format.toString());
+    return it != depths.end() ? it->second : 0;
+}
+
+std::vector<SensorMode>
+enumerateSensorModes(const std::shared_ptr<libcamera::Camera> &camera) {
+    using namespace libcamera;
+
+    std::vector<SensorMode> modes;
+    if (camera->acquire()) {
+        throw std::runtime_error("camera is in use");
+    }
+
+    auto raw = camera->generateConfiguration({StreamRole::Raw});
+    if (!raw) {
+        camera->release();
+        throw std::runtime_error("camera has no raw stream");
+    }
+
+    // Copy these out, since configuring the camera can change them
+    const StreamFormats formats = raw->at(0).formats();
+    for (const auto &format : formats.pixelformats()) {
+        unsigned int bitDepth = bitDepthOf(format);
+        if (!bitDepth) {
+            continue;
+        }
+        for (const auto &size : formats.sizes(format)) {
+            auto config = camera->generateConfiguration({StreamRole::Raw});
+            config->at(0).pixelFormat = format;
+            config->at(0).size = size;
+            if (config->validate() == CameraConfiguration::Invalid ||
+                camera->configure(config.get()) < 0) {
+                continue;
+            }
+
+            SensorMode mode{};
+            mode.width = size.width;
+            mode.height = size.height;
+            mode.bitDepth = bitDepth;
+
+            // Packed and unpacked variants of a format are the same mode
+            bool seen = false;
+            for (const auto &other : modes) {
+                seen |= other.width == mode.width &&
+                        other.height == mode.height &&
+                        other.bitDepth == mode.bitDepth;
+            }
+            if (seen) {
+                continue;
+            }
+
+            // Once configured, the camera's control limits are the mode's
+            const auto &controls = camera->controls();
+            auto duration = controls.find(controls::FrameDurationLimits.id());
+            if (duration != controls.end()) {
+                int64_t minFrameUs = duration->second.min().get<int64_t>();
+                mode.maxFps = minFrameUs > 0 ? 1e6 / minFrameUs : 0;
+            }
+            auto crop = controls.find(controls::ScalerCrop.id());
+            if (crop != controls.end()) {
+                auto rect = crop->second.max().get<Rectangle>();
+                mode.cropX = rect.x;
+                mode.cropY = rect.y;
+                mode.cropWidth = rect.width;
+                mode.cropHeight = rect.height;
+            }
+
+            modes.push_back(mode);
+        }
+    }
+
+    camera->release();
+    return modes;
+}